@@ -0,0 +1,195 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// New connections per second with one acceptor for the io_service_pool and
+// with one SO_REUSEPORT acceptor per io_service. The connections are as cheap
+// as they get: the server writes a single byte, the client reads it and resets
+// the connection, so accepting and handing out connections is most of the work.
+// The clients run in this process on a thread of their own.
+//
+// usage: bench_accept [seconds] [concurrent connects] [io threads] [port]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <server/io_service_pool.hpp>
+#include <server/server.hpp>
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+class hello_connection :
+    public boost::enable_shared_from_this<hello_connection>,
+    private boost::noncopyable
+{
+public:
+    hello_connection(boost::asio::io_service& io, std::atomic<uint64_t>* threads) :
+        socket_(io), threads_(threads)
+    {
+    }
+
+    tcp::socket& socket()
+    {
+        return socket_;
+    }
+
+    void start()
+    {
+        // Counts the connections per thread to show how they are spread
+        static thread_local size_t index = next_index_++;
+        threads_[index].fetch_add(1, std::memory_order_relaxed);
+
+        boost::asio::async_write(socket_, boost::asio::buffer(&byte_, 1),
+            boost::bind(&hello_connection::handle_write, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    static std::atomic<size_t> next_index_;
+
+private:
+    void handle_write(const boost::system::error_code& e)
+    {
+        if (!e)
+            socket_.async_read_some(boost::asio::buffer(&byte_, 1),
+                boost::bind(&hello_connection::handle_read, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_read(const boost::system::error_code&)
+    {
+    }
+
+    tcp::socket socket_;
+    std::atomic<uint64_t>* threads_;
+    uint8_t byte_ = 42;
+};
+
+std::atomic<size_t> hello_connection::next_index_{0};
+
+class connector
+{
+public:
+    connector(boost::asio::io_service& io, const tcp::endpoint& server, size_t& done) :
+        socket_(io), server_(server), done_(done)
+    {
+    }
+
+    void start()
+    {
+        socket_.async_connect(server_, boost::bind(&connector::handle_connect, this, boost::asio::placeholders::error));
+    }
+
+private:
+    void handle_connect(const boost::system::error_code& e)
+    {
+        if (e)
+        {
+            restart();
+            return;
+        }
+        socket_.async_read_some(boost::asio::buffer(&byte_, 1),
+            boost::bind(&connector::handle_read, this, boost::asio::placeholders::error));
+    }
+
+    void handle_read(const boost::system::error_code& e)
+    {
+        if (!e)
+            done_++;
+        restart();
+    }
+
+    // Resets the connection, so neither side keeps it in TIME_WAIT
+    void restart()
+    {
+        boost::system::error_code err;
+        socket_.set_option(tcp::socket::linger(true, 0), err);
+        socket_.close(err);
+        start();
+    }
+
+    tcp::socket socket_;
+    tcp::endpoint server_;
+    size_t& done_;
+    uint8_t byte_;
+};
+
+void run(accept_mode mode, const std::string& name, double seconds, size_t concurrency, size_t threads,
+    unsigned short port)
+{
+    std::vector<std::atomic<uint64_t>> per_thread(threads);
+    for (auto& t : per_thread)
+        t = 0;
+    hello_connection::next_index_ = 0;
+
+    io_service_pool io_pool{threads};
+    server<hello_connection, std::atomic<uint64_t>*> s{io_pool, "127.0.0.1", std::to_string(port),
+        per_thread.data(), admission_config{}, mode};
+    boost::thread server_thread{[&io_pool] { io_pool.run(); }};
+
+    boost::asio::io_service io;
+    tcp::endpoint endpoint{boost::asio::ip::address::from_string("127.0.0.1"), port};
+    size_t done = 0;
+    std::vector<std::unique_ptr<connector>> connectors;
+    for (size_t i = 0; i < concurrency; i++)
+    {
+        connectors.emplace_back(new connector{io, endpoint, done});
+        connectors.back()->start();
+    }
+
+    boost::asio::deadline_timer timer{io, boost::posix_time::microseconds(static_cast<int64_t>(seconds * 1e6))};
+    timer.async_wait([&io](const boost::system::error_code&) { io.stop(); });
+    auto start = std::chrono::steady_clock::now();
+    io.run();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    io_pool.stop();
+    server_thread.join();
+
+    std::cout << name << ": " << static_cast<double>(done) / elapsed << " connections/s, "
+        << s.admission().admitted << " accepted, accepted per thread";
+    for (auto& t : per_thread)
+        std::cout << " " << t.load();
+    std::cout << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 3;
+    size_t concurrency = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 32;
+    size_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : boost::thread::hardware_concurrency();
+    unsigned short port = static_cast<unsigned short>(argc > 4 ? std::stoi(argv[4]) : 25582);
+    if (threads == 0)
+        threads = 1;
+
+    std::cout << concurrency << " concurrent connects, " << threads << " io threads" << std::endl;
+    run(accept_mode::single, "single acceptor", seconds, concurrency, threads, port);
+    run(accept_mode::per_thread, "acceptor per thread", seconds, concurrency, threads, port + 1);
+}
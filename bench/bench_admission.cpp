@@ -0,0 +1,131 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Admission control against a flood of connections that never send anything.
+//
+// admit: cost of admit() and release() with limits per address, for one busy
+//        address and for many different addresses
+// flood: opens more idle connections than an in-process server admits, reports
+//        the rejections, the memory an admitted idle connection costs and how
+//        many are dropped once the handshake deadline passes
+//
+// usage: bench_admission [idle connections] [port]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include <connection/connection.hpp>
+#include <server/admission_control.hpp>
+#include <server/io_service_pool.hpp>
+#include <server/server.hpp>
+#include <world/world.hpp>
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+void bench_admit(const std::string& name, size_t addresses, size_t rounds)
+{
+    admission_control admission{admission_config{0, 16, 1e9, 1e9}};
+    std::vector<boost::asio::ip::address> list;
+    for (size_t i = 0; i < addresses; i++)
+        list.push_back(boost::asio::ip::address_v4{static_cast<uint32_t>(0x0a000000 + i)});
+
+    size_t admitted = 0;
+    rejection reason;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        const boost::asio::ip::address& a = list[i % list.size()];
+        if (admission.admit(a, reason))
+        {
+            admitted++;
+            admission.release(a);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "admit " << name << ": " << elapsed.count() * 1e9 / static_cast<double>(rounds)
+        << " ns per admit and release, " << admitted << " of " << rounds << " admitted" << std::endl;
+}
+
+// Resident memory of this process in bytes
+size_t resident()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, rss = 0;
+    statm >> pages >> rss;
+    return rss * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t idle = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::string port = argc > 2 ? argv[2] : "25581";
+
+    bench_admit("one address", 1, 1000000);
+    bench_admit("100000 addresses", 100000, 1000000);
+
+    // Admits idle connections until the server is full, the rest is rejected
+    world w;
+    io_service_pool io_pool{1};
+    server<connection, world*> s{io_pool, "127.0.0.1", port, &w, admission_config{idle, 0, 0, 0}};
+    boost::thread server_thread{[&io_pool] { io_pool.run(); }};
+
+    boost::asio::io_service io;
+    tcp::endpoint endpoint{boost::asio::ip::address::from_string("127.0.0.1"),
+        static_cast<unsigned short>(std::stoi(port))};
+    size_t before = resident();
+
+    std::vector<std::unique_ptr<tcp::socket>> sockets;
+    size_t attempts = idle + idle / 5;
+    for (size_t i = 0; i < attempts; i++)
+    {
+        sockets.emplace_back(new tcp::socket{io});
+        sockets.back()->connect(endpoint);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    admission_stats flooded = s.admission();
+    size_t after = resident();
+    std::cout << "flood: " << attempts << " idle connections, " << flooded.admitted << " admitted, "
+        << flooded.server_full << " rejected (server full), "
+        << static_cast<double>(after - before) / static_cast<double>(flooded.admitted)
+        << " bytes per admitted idle connection" << std::endl;
+
+    std::this_thread::sleep_for(connection::handshake_timeout + std::chrono::milliseconds(500));
+    admission_stats drained = s.admission();
+    std::cout << "after the handshake deadline: " << connection::deadlines_missed() << " dropped, "
+        << drained.open << " still open" << std::endl;
+
+    io_pool.stop();
+    server_thread.join();
+    return flooded.admitted == idle && drained.open == 0 ? 0 : 1;
+}
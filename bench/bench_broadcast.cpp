@@ -0,0 +1,164 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Fans one entity movement packet out to 1000 mock connections. The mock
+// connection queues packets like connection::send does and gathers the scatter
+// buffer like connection::flush_queue does, without any socket involved.
+//
+// per recipient: the packet is built for every connection and the length prefix
+//                is encoded on every flush (the old send path)
+// broadcast:     the packet is built and framed once and queued on every
+//                connection with broadcast()
+//
+// usage: bench_broadcast [rounds]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+
+#include <connection/broadcast.hpp>
+#include <protocol/packet_pool.hpp>
+#include <protocol/varint.hpp>
+
+namespace
+{
+
+constexpr size_t connection_count = 1000;
+
+class mock_connection
+{
+public:
+    void send(const packet_ptr& data, bool = false)
+    {
+        data->frame();
+        queue_.push_back(data);
+    }
+
+    void send_unframed(const packet_ptr& data)
+    {
+        queue_.push_back(data);
+    }
+
+    size_t flush()
+    {
+        scatter_.clear();
+        for (auto& p : queue_)
+        {
+            scatter_.emplace_back(p->header(), p->header_size());
+            scatter_.emplace_back(&p->data()[0], p->size());
+        }
+        return finish();
+    }
+
+    size_t flush_encoding_headers()
+    {
+        scatter_.clear();
+        headers_.clear();
+        headers_.reserve(queue_.size() * 5);
+        for (auto& p : queue_)
+        {
+            size_t start = headers_.size();
+            varint<size_t>::bytes(p->size(), headers_);
+            scatter_.emplace_back(&headers_[start], headers_.size() - start);
+            scatter_.emplace_back(&p->data()[0], p->size());
+        }
+        return finish();
+    }
+
+private:
+    size_t finish()
+    {
+        size_t bytes = boost::asio::buffer_size(scatter_);
+        queue_.clear();
+        return bytes;
+    }
+
+    std::vector<packet_ptr> queue_;
+    std::vector<uint8_t> headers_;
+    std::vector<boost::asio::const_buffer> scatter_;
+};
+
+// Entity look and relative move
+void write_movement(packet_buffer& p, int32_t entity)
+{
+    p << varint<unsigned int>(0x17) << varint<int32_t>(entity)
+        << static_cast<int8_t>(3) << static_cast<int8_t>(0) << static_cast<int8_t>(-2)
+        << static_cast<uint8_t>(64) << static_cast<uint8_t>(0) << true;
+}
+
+size_t per_recipient(std::vector<mock_connection>& connections, int32_t entity)
+{
+    size_t bytes = 0;
+    for (auto& c : connections)
+    {
+        packet_ptr p = packet_pool::acquire();
+        write_movement(*p, entity);
+        c.send_unframed(p);
+        bytes += c.flush_encoding_headers();
+    }
+    return bytes;
+}
+
+size_t serialize_once(std::vector<mock_connection>& connections, int32_t entity)
+{
+    packet_ptr p = packet_pool::acquire();
+    write_movement(*p, entity);
+
+    std::vector<mock_connection*> targets;
+    targets.reserve(connections.size());
+    for (auto& c : connections)
+        targets.push_back(&c);
+    broadcast(p, targets);
+
+    size_t bytes = 0;
+    for (auto& c : connections)
+        bytes += c.flush();
+    return bytes;
+}
+
+template <typename F>
+void run(const std::string& name, F f, size_t rounds)
+{
+    std::vector<mock_connection> connections(connection_count);
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+        bytes += f(connections, static_cast<int32_t>(i));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double packets = static_cast<double>(rounds * connection_count);
+    std::cout << name << ": " << rounds << " fan-outs to " << connection_count << " connections in "
+        << elapsed.count() << " s, " << static_cast<uint64_t>(packets / elapsed.count())
+        << " packets/s, " << elapsed.count() * 1e9 / packets << " ns per recipient, "
+        << bytes << " bytes queued" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+
+    run("per recipient (before)", per_recipient, rounds);
+    run("broadcast (after)", serialize_once, rounds);
+}
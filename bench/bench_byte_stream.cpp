@@ -0,0 +1,145 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Serialization throughput of byte_stream and byte_view:
+//
+// encode: a mix of small packets as the world sends them (entity teleports,
+//         keep alives, chunk headers, join game) written with << into a
+//         byte_stream that is cleared per packet, like a pooled packet
+// decode: player position and look packets read back with >>
+// chunk:  the ground-up data of chunks with a palette and with direct storage,
+//         which is mostly the block array
+//
+// usage: bench_byte_stream [million packets]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <protocol/byte_stream.hpp>
+#include <protocol/byte_view.hpp>
+#include <world/chunk.hpp>
+#include <world/generator.hpp>
+
+namespace
+{
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void encode(size_t count)
+{
+    byte_stream out;
+    size_t bytes = 0;
+    const std::string level_type = "flat";
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        out.clear();
+        int32_t n = static_cast<int32_t>(i);
+        switch (i % 4)
+        {
+        case 0:
+            out << varint<unsigned int>(0x18) << varint<int32_t>(n & 0xFFFF) << n << static_cast<int32_t>(n * 3)
+                << static_cast<int32_t>(-n) << static_cast<uint8_t>(n) << static_cast<uint8_t>(n >> 8) << true;
+            break;
+        case 1:
+            out << varint<unsigned int>(0x00) << varint<int32_t>(n & 0xFFFFF);
+            break;
+        case 2:
+            out << varint<unsigned int>(0x21) << n << static_cast<int32_t>(-n) << true
+                << static_cast<uint16_t>(0x0F) << varint<size_t>(12544);
+            break;
+        case 3:
+            out << varint<unsigned int>(0x01) << n << static_cast<uint8_t>(0) << static_cast<int8_t>(0)
+                << static_cast<uint8_t>(0) << static_cast<uint8_t>(10) << level_type << false;
+            break;
+        }
+        bytes += out.size();
+    }
+    double seconds = seconds_since(start);
+    std::cout << "encode: " << static_cast<double>(count) / seconds / 1e6 << " M packets/s, "
+        << static_cast<double>(bytes) / seconds / 1e6 << " MB/s" << std::endl;
+}
+
+void decode(size_t count)
+{
+    byte_stream in;
+    in << varint<unsigned int>(0x06) << 12.5 << 64.0 << -3.25 << 90.0f << -10.0f << true;
+    size_t size = in.size();
+    const uint8_t* data = &in.data()[0];
+
+    double sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        byte_view view{data, size};
+        varint<unsigned int> id;
+        double x, y, z;
+        float yaw, pitch;
+        bool on_ground;
+        view >> id >> x >> y >> z >> yaw >> pitch >> on_ground;
+        sum += x + y + z + yaw + pitch + on_ground;
+    }
+    double seconds = seconds_since(start);
+    std::cout << "decode: " << static_cast<double>(count) / seconds / 1e6 << " M packets/s, "
+        << static_cast<double>(count * size) / seconds / 1e6 << " MB/s" << (sum != 0 ? "" : " ") << std::endl;
+}
+
+void chunks(const std::string& name, const chunk& c, size_t rounds)
+{
+    byte_stream out;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        out.clear();
+        c.write_data(out);
+    }
+    double seconds = seconds_since(start);
+    std::cout << "chunk (" << name << "): " << static_cast<double>(rounds) / seconds << " chunks/s, "
+        << static_cast<double>(rounds * out.size()) / seconds / 1e6 << " MB/s" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t millions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10;
+    size_t count = millions * 1000 * 1000;
+
+    encode(count);
+    decode(count);
+
+    chunk flat{0, 0};
+    generate_flat(flat);
+    chunks("palette", flat, count / 2000);
+
+    // Over 256 states in a section forces direct storage
+    chunk direct{0, 0};
+    std::mt19937 random{1};
+    for (unsigned int y = 0; y < 64; y++)
+        for (unsigned int z = 0; z < 16; z++)
+            for (unsigned int x = 0; x < 16; x++)
+                direct.set_block(x, y, z, static_cast<uint16_t>(16 + random() % 2000));
+    chunks("direct", direct, count / 2000);
+}
@@ -0,0 +1,144 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Players join one after another near spawn and each gets the 9x9 chunks around
+// them in map chunk bulks. Between two joins a few random blocks change, which
+// invalidates the chunks they are in.
+//
+// encode every time: the chunk data is written for every player (no cache)
+// chunk_cache bulk:  map chunk bulks put together from the cached chunk data
+// chunk_cache 0x21:  the cached chunk data packets themselves, nothing is copied
+//
+// usage: bench_chunk_cache [players] [block changes per join]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <world/chunk_cache.hpp>
+#include <world/generator.hpp>
+
+namespace
+{
+
+constexpr int32_t view_distance = 4;
+// Players spawn in a square of spawn_area x spawn_area chunks
+constexpr int32_t spawn_area = 4;
+constexpr int32_t area = spawn_area + 2 * view_distance;
+
+struct chunks
+{
+    chunks()
+    {
+        for (int32_t z = 0; z < area; z++)
+        {
+            for (int32_t x = 0; x < area; x++)
+            {
+                all.emplace_back(new chunk{x, z});
+                generate_flat(*all.back());
+            }
+        }
+    }
+
+    chunk& at(int32_t x, int32_t z)
+    {
+        return *all[static_cast<size_t>(z * area + x)];
+    }
+
+    std::vector<std::unique_ptr<chunk>> all;
+};
+
+size_t encode(chunk_cache&, const std::vector<const chunk*>& view)
+{
+    size_t bytes = 0;
+    for (const chunk* c : view)
+    {
+        packet_ptr p = packet_pool::acquire(c->data_size());
+        c->write_data(*p);
+        bytes += p->size();
+    }
+    return bytes;
+}
+
+size_t cached(chunk_cache& cache, const std::vector<const chunk*>& view)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < view.size(); i += chunk_cache::max_bulk_chunks)
+    {
+        size_t end = std::min(view.size(), i + chunk_cache::max_bulk_chunks);
+        bytes += cache.map_chunk_bulk(&view[i], &view[0] + end)->size();
+    }
+    return bytes;
+}
+
+size_t cached_packets(chunk_cache& cache, const std::vector<const chunk*>& view)
+{
+    size_t bytes = 0;
+    for (const chunk* c : view)
+        bytes += cache.chunk_data(*c)->size();
+    return bytes;
+}
+
+template <typename F>
+void run(const std::string& name, F f, size_t players, size_t changes)
+{
+    chunks world;
+    chunk_cache cache;
+    std::mt19937 random{1};
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < players; i++)
+    {
+        for (size_t j = 0; j < changes; j++)
+            world.at(static_cast<int32_t>(random() % area), static_cast<int32_t>(random() % area))
+                .set_block(random() % 16, 4, random() % 16, block_state(1));
+
+        int32_t px = view_distance + static_cast<int32_t>(random() % spawn_area);
+        int32_t pz = view_distance + static_cast<int32_t>(random() % spawn_area);
+        std::vector<const chunk*> view;
+        for (int32_t z = pz - view_distance; z <= pz + view_distance; z++)
+            for (int32_t x = px - view_distance; x <= px + view_distance; x++)
+                view.push_back(&world.at(x, z));
+        bytes += f(cache, view);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const chunk_cache_stats& s = cache.stats();
+    std::cout << name << ": " << players << " joins in " << elapsed.count() << " s, "
+        << elapsed.count() * 1e6 / static_cast<double>(players) << " us per join, " << bytes << " bytes sent";
+    if (s.hits + s.misses)
+        std::cout << ", hit rate " << s.hit_rate() * 100 << "%, " << s.bytes_saved << " bytes of encoding saved, "
+            << s.bytes_encoded << " bytes encoded";
+    std::cout << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t players = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t changes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5;
+
+    run("encode every time", encode, players, changes);
+    run("chunk_cache bulk", cached, players, changes);
+    run("chunk_cache 0x21", cached_packets, players, changes);
+}
@@ -0,0 +1,138 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Memory per chunk of the palette compressed chunks against a naive layout that
+// keeps a uint16_t[4096] plus two full light arrays for every section, and the
+// cost of random block lookups and changes.
+//
+// flat:    the flat world generator
+// terrain: stone up to a varying height with ores, dirt and grass on top
+// noisy:   every block a random one of 1000 states, the worst case
+//
+// The naive size counts the same sections the chunk has allocated, and a full
+// column of 16 sections, both with the 256 biome bytes.
+//
+// usage: bench_chunk_memory [operations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <world/chunk.hpp>
+#include <world/generator.hpp>
+
+namespace
+{
+
+constexpr size_t naive_section_size = sizeof(uint16_t[4096]) + 2 * nibble_array::bytes;
+
+void terrain(chunk& c)
+{
+    std::mt19937 random{1};
+    std::uniform_int_distribution<unsigned int> height(60, 70);
+    std::uniform_real_distribution<double> ore(0, 1);
+    const uint16_t ores[] = {block_state(14), block_state(15), block_state(16), block_state(21), block_state(56)};
+
+    for (unsigned int z = 0; z < 16; z++)
+    {
+        for (unsigned int x = 0; x < 16; x++)
+        {
+            unsigned int top = height(random);
+            c.set_block(x, 0, z, block_state(7));
+            for (unsigned int y = 1; y <= top; y++)
+            {
+                uint16_t state = y + 4 < top ? block_state(1) : y < top ? block_state(3) : block_state(2);
+                if (state == block_state(1) && ore(random) < 0.02)
+                    state = ores[random() % 5];
+                c.set_block(x, y, z, state);
+                c.set_sky_light(x, y, z, 0);
+            }
+        }
+    }
+}
+
+void noisy(chunk& c)
+{
+    std::mt19937 random{2};
+    for (unsigned int y = 0; y < chunk::height; y++)
+        for (unsigned int z = 0; z < 16; z++)
+            for (unsigned int x = 0; x < 16; x++)
+                c.set_block(x, y, z, static_cast<uint16_t>(random() % 1000 + 1));
+}
+
+template <typename F>
+void run(const std::string& name, F generate, size_t operations)
+{
+    chunk c{0, 0};
+    generate(c);
+
+    size_t sections = 0;
+    std::string bits;
+    for (unsigned int i = 0; i < chunk::section_count; i++)
+    {
+        if (const section* s = c.get_section_at(i))
+        {
+            sections++;
+            bits += std::to_string(s->bits()) + " ";
+        }
+    }
+
+    size_t naive = sections * naive_section_size + 256;
+    size_t naive_full = chunk::section_count * naive_section_size + 256;
+    std::cout << name << ": " << c.memory_usage() << " bytes per chunk, naive " << naive
+        << " (" << 100.0 * static_cast<double>(c.memory_usage()) / static_cast<double>(naive) << "%), naive full column "
+        << naive_full << ", " << sections << " sections, bits per block " << bits << std::endl;
+
+    // Random lookups and changes that keep the palette the same
+    std::mt19937 random{3};
+    std::vector<unsigned int> positions(operations);
+    for (auto& p : positions)
+        p = random() % (16 * chunk::height * 16);
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned int sum = 0;
+    for (unsigned int p : positions)
+        sum += c.block(p & 0xF, p >> 8, (p >> 4) & 0xF);
+    auto looked_up = std::chrono::steady_clock::now();
+    for (unsigned int p : positions)
+    {
+        unsigned int x = p & 0xF, y = p >> 8, z = (p >> 4) & 0xF;
+        c.set_block(x, y, z, c.block(x ^ 1, y, z));
+    }
+    auto changed = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> lookup = looked_up - start;
+    std::chrono::duration<double> change = changed - looked_up;
+    std::cout << "  " << lookup.count() * 1e9 / static_cast<double>(operations) << " ns per lookup, "
+        << change.count() * 1e9 / static_cast<double>(operations) << " ns per change, data packet "
+        << c.data_size() << " bytes (checksum " << sum << ")" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t operations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+
+    run("flat", generate_flat, operations);
+    run("terrain", terrain, operations);
+    run("noisy", noisy, operations);
+}
@@ -0,0 +1,99 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// AES/CFB8 throughput on a single core, encrypting and decrypting, with AES-NI
+// against OpenSSL. CFB8 runs an AES block per byte, so this is the cost of every
+// byte an online mode server sends or receives. Both paths have to produce the
+// same bytes, and decrypting has to give back the input, in pieces of varying
+// size like a stream of packets.
+//
+// usage: bench_cipher [megabytes]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <protocol/cfb8.hpp>
+
+namespace
+{
+
+const uint8_t key[cfb8::key_size] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs data through a fresh cfb8 in pieces of 1 to 4096 bytes, in place
+double run(cfb8::mode mode, std::vector<uint8_t>& data, bool& hardware)
+{
+    std::mt19937 random{3};
+    std::uniform_int_distribution<size_t> piece(1, 4096);
+    cfb8 cipher{key, mode};
+    hardware = cipher.hardware();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < data.size(); )
+    {
+        size_t n = std::min(piece(random), data.size() - pos);
+        cipher.apply(data.data() + pos, data.data() + pos, n);
+        pos += n;
+    }
+    return seconds_since(start);
+}
+
+void report(const std::string& name, const std::vector<uint8_t>& input, std::vector<uint8_t>& encrypted)
+{
+    bool hardware = false;
+    encrypted = input;
+    double encrypt = run(cfb8::mode::encrypt, encrypted, hardware);
+    std::vector<uint8_t> decrypted = encrypted;
+    double decrypt = run(cfb8::mode::decrypt, decrypted, hardware);
+
+    double mb = static_cast<double>(input.size()) / 1e6;
+    std::cout << name << (hardware ? " (AES-NI)" : " (OpenSSL)") << ": encrypt " << mb / encrypt
+        << " MB/s, decrypt " << mb / decrypt << " MB/s"
+        << (decrypted == input ? "" : ", MISMATCH") << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+
+    std::vector<uint8_t> input(megabytes * 1000 * 1000);
+    std::mt19937 random{1};
+    for (auto& b : input)
+        b = static_cast<uint8_t>(random());
+
+    std::vector<uint8_t> native;
+    report("cfb8", input, native);
+
+    cfb8::disable_hardware(true);
+    std::vector<uint8_t> openssl;
+    report("cfb8", input, openssl);
+
+    std::cout << "ciphertexts " << (native == openssl ? "match" : "DIFFER") << std::endl;
+}
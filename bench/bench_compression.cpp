@@ -0,0 +1,154 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compression throughput and ratio for every zlib level on chunk data:
+//
+// flat:    the data of a chunk from the flat world generator
+// terrain: stone up to a varying height with ores, dirt and grass on top
+//
+// and the cost of putting a map chunk bulk of 10 cached chunks together from
+// their deflate segments against compressing the whole bulk.
+//
+// usage: bench_compression [rounds]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <protocol/compression.hpp>
+#include <world/chunk.hpp>
+#include <world/generator.hpp>
+
+namespace
+{
+
+void terrain(chunk& c)
+{
+    std::mt19937 random{1};
+    std::uniform_int_distribution<unsigned int> height(60, 70);
+    for (unsigned int z = 0; z < 16; z++)
+    {
+        for (unsigned int x = 0; x < 16; x++)
+        {
+            unsigned int top = height(random);
+            c.set_block(x, 0, z, block_state(7));
+            for (unsigned int y = 1; y <= top; y++)
+            {
+                uint16_t state = y + 4 < top ? block_state(1) : y < top ? block_state(3) : block_state(2);
+                if (state == block_state(1) && random() % 50 == 0)
+                    state = block_state(static_cast<uint16_t>(14 + random() % 3));
+                c.set_block(x, y, z, state);
+                c.set_sky_light(x, y, z, 0);
+            }
+        }
+    }
+}
+
+std::vector<uint8_t> chunk_data(void (*generate)(chunk&))
+{
+    chunk c{0, 0};
+    generate(c);
+    byte_stream out;
+    c.write_data(out);
+    return std::vector<uint8_t>(out.data(), out.data() + out.size());
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void levels(const std::string& name, const std::vector<uint8_t>& data, size_t rounds)
+{
+    for (int level = 1; level <= 9; level++)
+    {
+        std::vector<uint8_t> compressed;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; i++)
+        {
+            compressed.clear();
+            compress(data.data(), data.size(), level, compressed);
+        }
+        double deflate = seconds_since(start);
+
+        std::vector<uint8_t> out(data.size());
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; i++)
+            decompress(compressed.data(), compressed.size(), out.data(), out.size());
+        double inflate = seconds_since(start);
+
+        double mb = static_cast<double>(data.size() * rounds) / 1e6;
+        std::cout << name << " level " << level << ": " << data.size() << " -> " << compressed.size() << " bytes ("
+            << 100.0 * static_cast<double>(compressed.size()) / static_cast<double>(data.size()) << "%), compress "
+            << mb / deflate << " MB/s, decompress " << mb / inflate << " MB/s"
+            << (out == data ? "" : ", MISMATCH") << std::endl;
+    }
+}
+
+void bulk(const std::vector<uint8_t>& data, size_t rounds)
+{
+    constexpr size_t chunks = 10;
+    const int level = 3;
+    std::vector<uint8_t> whole;
+    for (size_t i = 0; i < chunks; i++)
+        whole.insert(whole.end(), data.begin(), data.end());
+    deflate_segment segment = compress_segment(data.data(), data.size(), level);
+
+    std::vector<uint8_t> compressed;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        compressed.clear();
+        compress(whole.data(), whole.size(), level, compressed);
+    }
+    double full = seconds_since(start);
+    size_t full_size = compressed.size();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        compressed.clear();
+        zlib_builder builder{compressed};
+        for (size_t c = 0; c < chunks; c++)
+            builder.segment(segment);
+        builder.finish();
+    }
+    double spliced = seconds_since(start);
+
+    std::vector<uint8_t> out(whole.size());
+    decompress(compressed.data(), compressed.size(), out.data(), out.size());
+    std::cout << "terrain bulk of " << chunks << " at level " << level << ": compressing it "
+        << full * 1e6 / static_cast<double>(rounds) << " us (" << full_size << " bytes), splicing cached segments "
+        << spliced * 1e6 / static_cast<double>(rounds) << " us (" << compressed.size() << " bytes)"
+        << (out == whole ? "" : ", MISMATCH") << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+
+    levels("flat", chunk_data(generate_flat), rounds);
+    std::vector<uint8_t> data = chunk_data(terrain);
+    levels("terrain", data, rounds);
+    bulk(data, rounds);
+}
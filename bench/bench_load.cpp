@@ -0,0 +1,320 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// End to end load on a server in this process, over loopback, with the
+// synthetic protocol 47 clients of sim_client.hpp. Three phases:
+//
+// ping:  status pings, 8 at a time, on an idle server
+// login: all clients log in at once (encryption and compression on, like main)
+// move:  every client sends player_position at the given rate, while status
+//        pings keep going, 2 at a time
+//
+// Reported are pings and logins per second, ping latencies (p50, p99, p999)
+// idle and under load, and the CPU time per client during the move phase: of
+// the server (process minus the client thread) and of the clients. The server
+// runs on one io thread and one world thread, like the clients on a machine
+// with few cores it shares the CPU with them.
+//
+// usage: bench_load [clients] [moves per second] [seconds] [pings] [port]
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/thread.hpp>
+
+#include <connection/authenticator.hpp>
+#include <connection/connection.hpp>
+#include <server/io_service_pool.hpp>
+#include <server/server.hpp>
+#include <world/world.hpp>
+
+#include "sim_client.hpp"
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+double cpu_seconds(clockid_t clock)
+{
+    timespec t;
+    clock_gettime(clock, &t);
+    return static_cast<double>(t.tv_sec) + static_cast<double>(t.tv_nsec) * 1e-9;
+}
+
+double since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// Sorted latencies in microseconds
+struct latencies
+{
+    std::vector<double> us;
+    size_t failed = 0;
+
+    double percentile(double p)
+    {
+        if (us.empty())
+            return 0;
+        std::sort(us.begin(), us.end());
+        size_t i = static_cast<size_t>(p * static_cast<double>(us.size() - 1) + 0.5);
+        return us[i];
+    }
+
+    void print(const std::string& name, double seconds)
+    {
+        std::cout << name << ": " << us.size() << " pings in " << seconds << " s, "
+            << static_cast<uint64_t>(static_cast<double>(us.size()) / seconds) << "/s, " << failed
+            << " failed, latency p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, p999 "
+            << percentile(0.999) << " us" << std::endl;
+    }
+};
+
+// Keeps concurrency status pings going until stopped or limit are done
+class ping_loop
+{
+public:
+    ping_loop(boost::asio::io_service& io, const tcp::endpoint& server, latencies& l, size_t limit,
+            std::function<void()> done = nullptr) :
+        io_(io), server_(server), latencies_(l), limit_(limit), started_(0), stopped_(false), done_(done)
+    {
+    }
+
+    void start(size_t concurrency)
+    {
+        for (size_t i = 0; i < concurrency; i++)
+            ping();
+    }
+
+    void stop()
+    {
+        stopped_ = true;
+    }
+
+private:
+    void ping()
+    {
+        if (stopped_ || started_ == limit_)
+            return;
+        started_++;
+        auto start = clock_type::now();
+        std::make_shared<sim_client>(io_, server_)->status_ping([this, start](bool ok)
+            {
+                if (ok)
+                    latencies_.us.push_back(since(start) * 1e6);
+                else
+                    latencies_.failed++;
+                if (latencies_.us.size() + latencies_.failed == limit_ && done_)
+                    done_();
+                ping();
+            });
+    }
+
+    boost::asio::io_service& io_;
+    tcp::endpoint server_;
+    latencies& latencies_;
+    size_t limit_;
+    size_t started_;
+    bool stopped_;
+    std::function<void()> done_;
+};
+
+// A logged in client walking back and forth along x
+class mover : public std::enable_shared_from_this<mover>
+{
+public:
+    mover(boost::asio::io_service& io, const tcp::endpoint& server, double rate) :
+        client_(std::make_shared<sim_client>(io, server)), timer_(io),
+        interval_(std::chrono::microseconds(static_cast<int64_t>(1e6 / rate))), step_(0), stopped_(false)
+    {
+    }
+
+    void login(const std::string& name, std::function<void(bool)> done)
+    {
+        client_->login(name, std::move(done));
+    }
+
+    void start()
+    {
+        next_ = clock_type::now() + interval_;
+        move();
+    }
+
+    void stop()
+    {
+        stopped_ = true;
+        timer_.cancel();
+        client_->close();
+    }
+
+    const sim_client& client() const
+    {
+        return *client_;
+    }
+
+private:
+    void move()
+    {
+        auto self = shared_from_this();
+        timer_.expires_at(next_);
+        timer_.async_wait([this, self](const boost::system::error_code& e)
+            {
+                if (e || stopped_ || !client_->playing())
+                    return;
+                packets::play::player_position p;
+                p.x = 0.5 + 4 * std::sin(step_++ * 0.05);
+                p.y = 5;
+                p.z = 0.5;
+                p.on_ground = true;
+                client_->send(encode_packet(p));
+                next_ += interval_;
+                move();
+            });
+    }
+
+    std::shared_ptr<sim_client> client_;
+    boost::asio::steady_timer timer_;
+    clock_type::duration interval_;
+    clock_type::time_point next_;
+    int step_;
+    bool stopped_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t clients = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+    double rate = argc > 2 ? std::strtod(argv[2], nullptr) : 20;
+    double seconds = argc > 3 ? std::strtod(argv[3], nullptr) : 5;
+    size_t pings = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 5000;
+    std::string port = argc > 5 ? argv[5] : "25582";
+    if (!(rate > 0))
+    {
+        std::cerr << "usage: bench_load [clients] [moves per second] [seconds] [pings] [port]" << std::endl
+            << "moves per second has to be more than 0" << std::endl;
+        return 2;
+    }
+
+    stub_session_service sessions;
+    authenticator auth{sessions};
+    world w{1, compression_config{256, 3, 1}, &auth};
+    w.start();
+    io_service_pool io_pool{1};
+    server<connection, world*> s{io_pool, "127.0.0.1", port, &w};
+    boost::thread server_thread{[&io_pool] { io_pool.run(); }};
+
+    boost::asio::io_service io;
+    tcp::endpoint endpoint{boost::asio::ip::address::from_string("127.0.0.1"),
+        static_cast<unsigned short>(std::stoi(port))};
+
+    // Status pings on the idle server
+    latencies idle;
+    auto start = clock_type::now();
+    ping_loop idle_pings{io, endpoint, idle, pings, [&io] { io.stop(); }};
+    idle_pings.start(8);
+    io.run();
+    idle.print("ping (idle)", since(start));
+    io.reset();
+
+    // Logins
+    std::vector<std::shared_ptr<mover>> movers;
+    latencies logins;
+    start = clock_type::now();
+    for (size_t i = 0; i < clients; i++)
+    {
+        movers.push_back(std::make_shared<mover>(io, endpoint, rate));
+        movers.back()->login("load" + std::to_string(i), [&, start](bool ok)
+            {
+                if (ok)
+                    logins.us.push_back(since(start) * 1e6);
+                else
+                    logins.failed++;
+                if (logins.us.size() + logins.failed == clients)
+                    io.stop();
+            });
+    }
+    io.run();
+    double login_seconds = since(start);
+    io.reset();
+    std::cout << "login: " << logins.us.size() << " of " << clients << " in " << login_seconds << " s, "
+        << static_cast<uint64_t>(static_cast<double>(logins.us.size()) / login_seconds) << " connections/s, "
+        << "done after p50 " << logins.percentile(0.5) / 1000 << " ms, p99 " << logins.percentile(0.99) / 1000
+        << " ms" << std::endl;
+
+    // Movement, with pings alongside
+    latencies loaded;
+    ping_loop loaded_pings{io, endpoint, loaded, static_cast<size_t>(-1)};
+    for (auto& m : movers)
+        m->start();
+    loaded_pings.start(2);
+
+    double process_cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    double client_cpu = cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+    start = clock_type::now();
+    boost::asio::steady_timer end{io, std::chrono::microseconds(static_cast<int64_t>(seconds * 1e6))};
+    end.async_wait([&](const boost::system::error_code&) { io.stop(); });
+    io.run();
+    double move_seconds = since(start);
+    client_cpu = cpu_seconds(CLOCK_THREAD_CPUTIME_ID) - client_cpu;
+    double server_cpu = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID) - process_cpu - client_cpu;
+
+    uint64_t sent = 0, frames = 0, bytes = 0;
+    size_t playing = 0;
+    for (auto& m : movers)
+    {
+        sent += m->client().packets_sent();
+        frames += m->client().frames_received();
+        bytes += m->client().bytes_received();
+        playing += m->client().playing();
+    }
+
+    loaded_pings.stop();
+    for (auto& m : movers)
+        m->stop();
+    io.reset();
+    io.poll();
+
+    io_pool.stop();
+    server_thread.join();
+    w.stop();
+
+    loaded.print("ping (under load)", move_seconds);
+    double n = static_cast<double>(std::max<size_t>(playing, 1));
+    std::cout << "move: " << playing << " clients at " << rate << "/s for " << move_seconds << " s, sent "
+        << static_cast<uint64_t>(static_cast<double>(sent) / move_seconds) << " packets/s, received "
+        << static_cast<uint64_t>(static_cast<double>(frames) / move_seconds) << " frames/s, "
+        << bytes / 1024 << " KiB" << std::endl;
+    std::cout << "cpu per client: server " << server_cpu / move_seconds / n * 1e6 << " us/s, clients "
+        << client_cpu / move_seconds / n * 1e6 << " us/s (" << 100 * (server_cpu + client_cpu) / move_seconds
+        << "% of a core in total)" << std::endl;
+    return idle.failed || logins.failed || playing < clients ? 1 : 0;
+}
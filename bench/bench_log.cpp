@@ -0,0 +1,201 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Log calls per second from several threads at once, all logging a line with
+// a few arguments of different types.
+//
+// mutex (before): the old logger, every call takes a global mutex, formats the
+//                 timestamp with an ostringstream and flushes every line
+// rings (after):  misc/log.hpp, every thread formats into its own ring and a
+//                 writer thread does the rest
+//
+// The time of the rings includes waiting for the writer to write everything.
+// Records that didn't fit in a ring are reported as dropped.
+//
+// After that a packet debug line with a hexdump of a 64 byte packet, on one
+// thread, with the packet category masked out and with it logged:
+//
+// string hexdump:  the hexdump is built as a string before log::debug is called,
+//                  like it was before hex_dump
+// log::debug:      the hexdump is a hex_dump, formatted when the record is
+// LOG_DEBUG:       the arguments aren't evaluated unless the record is logged
+//
+// usage: bench_log [calls per thread] [log file, /dev/null by default]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/date_time.hpp>
+
+#include <misc/hex_dump.hpp>
+#include <misc/log.hpp>
+
+namespace
+{
+
+class mutex_log
+{
+public:
+    explicit mutex_log(std::ostream& stream) : stream_(stream)
+    {
+    }
+
+    template <typename... T>
+    void info(T... t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream s;
+        s << "[" << boost::posix_time::microsec_clock::universal_time() << "]" << "  <Info>    ";
+        write(stream_, s.str(), t...);
+    }
+
+private:
+    template <typename H>
+    void write(std::ostream& l, H head)
+    {
+        l << head << std::endl;
+    }
+
+    template <typename H, typename... T>
+    void write(std::ostream& l, H head, T... tail)
+    {
+        l << head << " ";
+        write(l, tail...);
+    }
+
+    std::ostream& stream_;
+    std::mutex mutex_;
+};
+
+template <typename F>
+double run(size_t threads, size_t calls, F f)
+{
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([t, calls, &f]
+            {
+                std::string address = "127.0.0." + std::to_string(t);
+                for (size_t i = 0; i < calls; i++)
+                    f(address, i);
+            });
+    for (auto& w : workers)
+        w.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string string_hexdump(const uint8_t* data, size_t size)
+{
+    std::stringstream ss;
+    ss << std::endl << std::hex;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (i > 0 && i % 16 == 0)
+            ss << std::endl;
+        unsigned int val = data[i];
+        ss << std::setw(2) << std::setfill('0') << val << " ";
+    }
+    return ss.str();
+}
+
+template <typename F>
+void packet_debug(const std::string& name, size_t calls, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; i++)
+        f(i);
+    log::flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() * 1e9 / static_cast<double>(calls) << " ns per call" << std::endl;
+}
+
+void report(const std::string& name, size_t threads, size_t calls, double elapsed)
+{
+    std::cout << name << ", " << threads << " threads: " << static_cast<uint64_t>(
+        static_cast<double>(threads * calls) / elapsed) << " calls/s";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t calls = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::string path = argc > 2 ? argv[2] : "/dev/null";
+
+    std::ofstream before_file(path);
+    mutex_log before{before_file};
+    std::ofstream after_file(path);
+    log::stream(after_file, log::level::info);
+
+    for (size_t threads : {1, 2, 4, 8})
+    {
+        double elapsed = run(threads, calls, [&before](const std::string& address, size_t i)
+            {
+                before.info(address, "received packet with opcode", i & 0x3F, "in state", 3, "of", 2.5, "ms");
+            });
+        report("mutex (before)", threads, calls, elapsed);
+        std::cout << std::endl;
+
+        uint64_t dropped = log::dropped();
+        elapsed = run(threads, calls, [](const std::string& address, size_t i)
+            {
+                log::info(address, "received packet with opcode", i & 0x3F, "in state", 3, "of", 2.5, "ms");
+            });
+        double logged = elapsed;
+        auto start = std::chrono::steady_clock::now();
+        log::flush();
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report("rings (after)", threads, calls, elapsed);
+        std::cout << ", " << static_cast<uint64_t>(static_cast<double>(threads * calls) / logged)
+            << " calls/s before the writer caught up, " << log::dropped() - dropped << " of "
+            << threads * calls << " dropped" << std::endl;
+    }
+
+    log::stream(after_file, log::level::debug, 1 << static_cast<int>(log::dbg::packet));
+    std::vector<uint8_t> packet(64);
+    for (size_t i = 0; i < packet.size(); i++)
+        packet[i] = static_cast<uint8_t>(i * 7);
+    std::string address = "127.0.0.1";
+    size_t debug_calls = calls / 4;
+
+    for (uint64_t mask : {0ULL, 0xFFFFFFFFFFFFFFFFULL})
+    {
+        log::set_debug_mask(mask);
+        std::string state = mask ? " (logged)" : " (masked)";
+        packet_debug("string hexdump" + state, debug_calls, [&](size_t)
+            {
+                log::debug(log::dbg::packet, address, "received packet", string_hexdump(packet.data(), packet.size()));
+            });
+        packet_debug("log::debug" + state, debug_calls, [&](size_t)
+            {
+                log::debug(log::dbg::packet, address, "received packet", hex_dump{packet.data(), packet.size()});
+            });
+        packet_debug("LOG_DEBUG" + state, debug_calls, [&](size_t)
+            {
+                LOG_DEBUG(log::dbg::packet, address, "received packet", hex_dump{packet.data(), packet.size()});
+            });
+    }
+}
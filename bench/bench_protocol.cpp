@@ -0,0 +1,310 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmarks of the protocol codecs, on Google Benchmark:
+//
+// varint_*:       VarInts of every length, through varint_codec and byte_stream
+// string_*:       length prefixed strings through byte_stream
+// be_*:           big endian fields through byte_stream
+// packet_*:       the packets client.cpp sends, encoded and framed like
+//                 connection::send does (the status response both built and
+//                 from the status_cache)
+// scatter_buffer: the scatter buffer connection::flush_queue gathers for a
+//                 batch of 1 to 1000 queued packets
+//
+// For comparing commits, write JSON and diff with the compare.py of Google
+// Benchmark:
+//
+//     bench_protocol --benchmark_format=json > before.json
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/asio/buffer.hpp>
+
+#include <protocol/byte_stream.hpp>
+#include <protocol/packet_pool.hpp>
+#include <protocol/packets.hpp>
+#include <protocol/schema.hpp>
+#include <protocol/varint.hpp>
+#include <server/status_cache.hpp>
+
+namespace
+{
+
+// Values per iteration of the codec benchmarks
+constexpr size_t batch = 256;
+
+// The smallest value with an encoding of length bytes
+uint64_t varint_of_length(int64_t length)
+{
+    return length == 1 ? 1 : uint64_t{1} << (7 * (length - 1));
+}
+
+void varint_encode(benchmark::State& state)
+{
+    uint64_t value = varint_of_length(state.range(0));
+    uint8_t out[batch * 10];
+    for (auto _ : state)
+    {
+        uint8_t* p = out;
+        for (size_t i = 0; i < batch; i++)
+            p = varint_codec::encode(p, value + (i & 1));
+        benchmark::DoNotOptimize(p);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK(varint_encode)->DenseRange(1, 10);
+
+void varint_decode(benchmark::State& state)
+{
+    uint64_t value = varint_of_length(state.range(0));
+    std::vector<uint8_t> in(batch * 10 + 8);
+    uint8_t* end = in.data();
+    for (size_t i = 0; i < batch; i++)
+        end = varint_codec::encode(end, value + (i & 1));
+    size_t size = static_cast<size_t>(end - in.data());
+
+    for (auto _ : state)
+    {
+        uint64_t sum = 0;
+        for (size_t pos = 0; pos < size;)
+        {
+            uint64_t v = 0;
+            pos += varint_codec::decode(in.data() + pos, in.size() - pos, 10, v);
+            sum += v;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK(varint_decode)->DenseRange(1, 10);
+
+// varint<unsigned int>, so at most 5 bytes
+void varint_stream_encode(benchmark::State& state)
+{
+    unsigned int value = static_cast<unsigned int>(varint_of_length(state.range(0)));
+    byte_stream s{batch * 5};
+    for (auto _ : state)
+    {
+        s.clear();
+        for (size_t i = 0; i < batch; i++)
+            s << varint<unsigned int>(value + (i & 1));
+        benchmark::DoNotOptimize(s.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK(varint_stream_encode)->DenseRange(1, 5);
+
+void varint_stream_decode(benchmark::State& state)
+{
+    unsigned int value = static_cast<unsigned int>(varint_of_length(state.range(0)));
+    byte_stream s{batch * 5};
+    for (size_t i = 0; i < batch; i++)
+        s << varint<unsigned int>(value + (i & 1));
+
+    for (auto _ : state)
+    {
+        s.pos(0);
+        unsigned int sum = 0;
+        varint<unsigned int> v;
+        for (size_t i = 0; i < batch; i++)
+        {
+            s >> v;
+            sum += v;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK(varint_stream_decode)->DenseRange(1, 5);
+
+void string_encode(benchmark::State& state)
+{
+    std::string value(static_cast<size_t>(state.range(0)), 'x');
+    byte_stream s{batch * (value.size() + 2)};
+    for (auto _ : state)
+    {
+        s.clear();
+        for (size_t i = 0; i < batch; i++)
+            s << value;
+        benchmark::DoNotOptimize(s.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * batch * value.size()));
+}
+BENCHMARK(string_encode)->Arg(0)->Arg(16)->Arg(128)->Arg(4096);
+
+void string_decode(benchmark::State& state)
+{
+    std::string value(static_cast<size_t>(state.range(0)), 'x');
+    byte_stream s{batch * (value.size() + 2)};
+    for (size_t i = 0; i < batch; i++)
+        s << value;
+
+    std::string out;
+    for (auto _ : state)
+    {
+        s.pos(0);
+        for (size_t i = 0; i < batch; i++)
+        {
+            s >> out;
+            benchmark::DoNotOptimize(out.data());
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * batch * value.size()));
+}
+BENCHMARK(string_decode)->Arg(0)->Arg(16)->Arg(128)->Arg(4096);
+
+template <typename T>
+void be_encode(benchmark::State& state)
+{
+    byte_stream s{batch * sizeof(T)};
+    for (auto _ : state)
+    {
+        s.clear();
+        for (size_t i = 0; i < batch; i++)
+            s << static_cast<T>(i);
+        benchmark::DoNotOptimize(s.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK_TEMPLATE(be_encode, int16_t);
+BENCHMARK_TEMPLATE(be_encode, int32_t);
+BENCHMARK_TEMPLATE(be_encode, int64_t);
+BENCHMARK_TEMPLATE(be_encode, float);
+BENCHMARK_TEMPLATE(be_encode, double);
+
+template <typename T>
+void be_decode(benchmark::State& state)
+{
+    byte_stream s{batch * sizeof(T)};
+    for (size_t i = 0; i < batch; i++)
+        s << static_cast<T>(i);
+
+    for (auto _ : state)
+    {
+        s.pos(0);
+        T sum = 0;
+        for (size_t i = 0; i < batch; i++)
+        {
+            T v;
+            s >> v;
+            sum += v;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+}
+BENCHMARK_TEMPLATE(be_decode, int16_t);
+BENCHMARK_TEMPLATE(be_decode, int32_t);
+BENCHMARK_TEMPLATE(be_decode, int64_t);
+BENCHMARK_TEMPLATE(be_decode, float);
+BENCHMARK_TEMPLATE(be_decode, double);
+
+// Encodes and frames p, the packet goes back to the pool every iteration
+template <typename P>
+void encode_packet(benchmark::State& state, const P& p)
+{
+    for (auto _ : state)
+    {
+        packet_ptr packet = make_packet(p);
+        packet->frame();
+        benchmark::DoNotOptimize(packet->header());
+    }
+}
+
+void packet_status_response(benchmark::State& state)
+{
+    packets::status::response response;
+    response.json = R"({"version":{"name":"1.8","protocol":47},"players":{"max":20,"online":3},)"
+        R"("description":{"text":"Bariumsulfate"}})";
+    encode_packet(state, response);
+}
+BENCHMARK(packet_status_response);
+
+void packet_status_cached(benchmark::State& state)
+{
+    status_cache cache{"Bariumsulfate", 20};
+    for (auto _ : state)
+    {
+        packet_ptr packet = cache.response(3);
+        benchmark::DoNotOptimize(packet->header());
+    }
+}
+BENCHMARK(packet_status_cached);
+
+void packet_pong(benchmark::State& state)
+{
+    encode_packet(state, packets::status::ping{1234567890123});
+}
+BENCHMARK(packet_pong);
+
+void packet_login_success(benchmark::State& state)
+{
+    encode_packet(state, packets::login::success{"0d1c7c5a-3b3c-3d76-a5b5-4e0d2e4f9b1a", "bariumsulfate"});
+}
+BENCHMARK(packet_login_success);
+
+void packet_join_game(benchmark::State& state)
+{
+    packets::play::join_game join;
+    join.entity_id = 1234;
+    join.game_mode = 0;
+    join.dimension = 0;
+    join.difficulty = 0;
+    join.max_players = 10;
+    join.level_type = "flat";
+    join.reduced_debug_info = true;
+    encode_packet(state, join);
+}
+BENCHMARK(packet_join_game);
+
+// Small packets (keep alives), framed before they are queued
+void scatter_buffer(benchmark::State& state)
+{
+    std::vector<packet_ptr> send_buffer;
+    for (int64_t i = 0; i < state.range(0); i++)
+    {
+        packet_ptr p = make_packet(packets::play::keep_alive{static_cast<int32_t>(i)});
+        p->frame();
+        send_buffer.push_back(p);
+    }
+
+    for (auto _ : state)
+    {
+        std::vector<boost::asio::const_buffer> scatter_buffer;
+        scatter_buffer.reserve(send_buffer.size() * 2);
+        for (auto& buf : send_buffer)
+        {
+            scatter_buffer.emplace_back(buf->header(), buf->header_size());
+            scatter_buffer.emplace_back(buf->body(), buf->body_size());
+        }
+        benchmark::DoNotOptimize(boost::asio::buffer_size(scatter_buffer));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(scatter_buffer)->RangeMultiplier(10)->Range(1, 1000);
+
+}
+
+BENCHMARK_MAIN();
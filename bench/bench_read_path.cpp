@@ -0,0 +1,210 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures how many packets per second a single io thread can pull out of a
+// socket. The byte_reader replicates the old read path that issued one async_read
+// per length byte and one for the packet body, the buffered_reader uses the
+// frame_reader the connection uses now.
+//
+// usage: bench_read_path [packets]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <connection/frame_reader.hpp>
+#include <protocol/byte_stream.hpp>
+#include <protocol/varint.hpp>
+
+namespace
+{
+
+using namespace boost::asio;
+typedef local::stream_protocol::socket socket_type;
+
+constexpr size_t packets_per_block = 1000;
+constexpr size_t buffer_limit = 8192;
+
+// Builds a block of player position packets as a client sends them while walking
+std::vector<uint8_t> make_block()
+{
+    byte_stream packet;
+    packet << varint<unsigned int>(0x04) << 12.5 << 64.0 << -3.25 << true;
+
+    byte_stream block;
+    for (size_t i = 0; i < packets_per_block; i++)
+    {
+        block << varint<size_t>(packet.size());
+        block.write(packet.data(), packet.size());
+    }
+    return std::vector<uint8_t>(block.data(), block.data() + block.size());
+}
+
+void feed(socket_type& s, const std::vector<uint8_t>& block, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++)
+        write(s, buffer(block));
+}
+
+class byte_reader
+{
+public:
+    byte_reader(socket_type& s, size_t total) : socket_(s), total_{total}, count_{0} {}
+
+    void start()
+    {
+        read_header();
+    }
+
+    size_t count() const
+    {
+        return count_;
+    }
+
+private:
+    void read_header()
+    {
+        len_idx_ = 0;
+        buffer_.resize(1);
+        async_read(socket_, buffer(const_cast<uint8_t*>(buffer_.data()), buffer_.size()),
+            boost::bind(&byte_reader::handle_read_header, this, placeholders::error));
+    }
+
+    void handle_read_header(const boost::system::error_code& e)
+    {
+        if (e)
+            return;
+
+        if (len_.append_byte(buffer_.data()[0], len_idx_++))
+        {
+            async_read(socket_, buffer(const_cast<uint8_t*>(buffer_.data()), buffer_.size()),
+                boost::bind(&byte_reader::handle_read_header, this, placeholders::error));
+        }
+        else
+        {
+            buffer_.resize(len_);
+            async_read(socket_, buffer(const_cast<uint8_t*>(buffer_.data()), buffer_.size()),
+                boost::bind(&byte_reader::handle_read_body, this, placeholders::error));
+        }
+    }
+
+    void handle_read_body(const boost::system::error_code& e)
+    {
+        if (e)
+            return;
+
+        buffer_.pos(0);
+        varint<unsigned int> opcode;
+        buffer_ >> opcode;
+
+        if (++count_ < total_)
+            read_header();
+    }
+
+    socket_type& socket_;
+    size_t total_;
+    size_t count_;
+    varint<size_t> len_;
+    int len_idx_;
+    byte_stream buffer_;
+};
+
+class buffered_reader
+{
+public:
+    buffered_reader(socket_type& s, size_t total) :
+        socket_(s), total_{total}, count_{0}, reader_{4 * buffer_limit, buffer_limit}
+    {
+    }
+
+    void start()
+    {
+        socket_.async_read_some(reader_.prepare(),
+            boost::bind(&buffered_reader::handle_read, this,
+            placeholders::error, placeholders::bytes_transferred));
+    }
+
+    size_t count() const
+    {
+        return count_;
+    }
+
+private:
+    void handle_read(const boost::system::error_code& e, size_t bytes_transferred)
+    {
+        if (e)
+            return;
+
+        reader_.commit(bytes_transferred);
+
+        packet_view frame;
+        while (reader_.next(frame))
+        {
+            varint<unsigned int> opcode;
+            frame >> opcode;
+            count_++;
+        }
+
+        if (count_ < total_)
+            start();
+    }
+
+    socket_type& socket_;
+    size_t total_;
+    size_t count_;
+    frame_reader reader_;
+};
+
+template <class R>
+void run(const std::string& name, size_t blocks)
+{
+    io_service io;
+    socket_type in{io};
+    socket_type out{io};
+    local::connect_pair(in, out);
+
+    std::vector<uint8_t> block = make_block();
+    R reader{in, blocks * packets_per_block};
+
+    auto start = std::chrono::steady_clock::now();
+    boost::thread writer{boost::bind(&feed, boost::ref(out), boost::cref(block), blocks)};
+    reader.start();
+    io.run();
+    writer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << reader.count() << " packets in " << elapsed.count() << " s, "
+        << static_cast<uint64_t>(reader.count() / elapsed.count()) << " packets/s per io thread"
+        << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t packets = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    size_t blocks = std::max<size_t>(packets / packets_per_block, 1);
+
+    run<byte_reader>("byte by byte (before)", blocks);
+    run<buffered_reader>("frame_reader (after)", blocks);
+}
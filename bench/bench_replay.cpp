@@ -0,0 +1,288 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Replays a capture (bariumsulfate --capture <file>) against a server in this
+// process, over loopback. Every captured connection that pinged or logged in is
+// a template, the synthetic clients take turns using them. A client pings like
+// its template did, or logs in under a name of its own (its own key exchange,
+// the captured one can't be reused) and then sends the play packets of the
+// template with their captured timing, divided by speed, and stays until the
+// template closed. Keep alives are answered live instead of replayed.
+//
+// The clients are spread over the first second. Admission control is off, all
+// of them come from 127.0.0.1.
+//
+// usage: bench_replay <capture file> [clients] [speed] [port]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/thread.hpp>
+
+#include <connection/authenticator.hpp>
+#include <connection/connection.hpp>
+#include <connection/packet_capture.hpp>
+#include <server/io_service_pool.hpp>
+#include <server/server.hpp>
+#include <world/world.hpp>
+
+#include "sim_client.hpp"
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+struct timed_packet
+{
+    uint64_t time;  // microseconds after the login succeeded
+    sim_packet packet;
+};
+
+// What a captured connection did
+struct session
+{
+    int next_state = 0;       // 0 until the handshake
+    bool playing = false;     // the login succeeded
+    uint64_t login_time = 0;
+    uint64_t end = 0;         // when it closed, microseconds after the login
+    std::vector<timed_packet> play;
+};
+
+unsigned int packet_id(const std::vector<uint8_t>& packet)
+{
+    byte_view view{packet.data(), packet.size()};
+    varint<unsigned int> id;
+    view >> id;
+    return id;
+}
+
+std::vector<session> load(const std::string& path, uint64_t& records)
+{
+    capture_reader reader{path};
+    std::map<uint32_t, session> sessions;
+    capture_record r;
+    records = 0;
+    while (reader.next(r))
+    {
+        records++;
+        session& s = sessions[r.connection];
+        if (r.event == capture_event::outbound && s.next_state == 2 && !s.playing)
+        {
+            if (packet_id(r.packet()) == packets::login::success::id)
+            {
+                s.playing = true;
+                s.login_time = r.time;
+            }
+        }
+        else if (r.event == capture_event::inbound && s.next_state == 0)
+        {
+            std::vector<uint8_t> packet = r.packet();
+            byte_view view{packet.data(), packet.size()};
+            varint<unsigned int> id;
+            view >> id;
+            packets::handshaking::handshake h;
+            decode(view, h);
+            s.next_state = h.next_state;
+        }
+        else if (r.event == capture_event::close && s.playing)
+            s.end = r.time - s.login_time;
+        else if (r.event == capture_event::inbound && s.playing)
+        {
+            std::vector<uint8_t> packet = r.packet();
+            if (packet_id(packet) != packets::play::keep_alive::id)
+                s.play.push_back(timed_packet{r.time - s.login_time, std::move(packet)});
+        }
+    }
+
+    std::vector<session> templates;
+    for (auto& s : sessions)
+    {
+        if (s.second.next_state == 1 || s.second.playing)
+            templates.push_back(std::move(s.second));
+    }
+    return templates;
+}
+
+struct totals
+{
+    size_t running = 0;
+    size_t pings = 0;
+    size_t logins = 0;
+    size_t failed = 0;
+    uint64_t replayed = 0;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+};
+
+// One synthetic client, replaying one template
+class replayer : public std::enable_shared_from_this<replayer>
+{
+public:
+    replayer(boost::asio::io_service& io, const tcp::endpoint& server, const session& s, double speed,
+            totals& t) :
+        client_(std::make_shared<sim_client>(io, server)), session_(s), speed_(speed), timer_(io), next_(0),
+        totals_(t)
+    {
+    }
+
+    void start(size_t index)
+    {
+        auto self = shared_from_this();
+        totals_.running++;
+        if (session_.next_state == 1)
+        {
+            client_->status_ping([this, self](bool ok)
+                {
+                    totals_.pings += ok;
+                    finish(ok);
+                });
+            return;
+        }
+
+        client_->login("replay" + std::to_string(index), [this, self](bool ok)
+            {
+                if (!ok)
+                    return finish(false);
+                totals_.logins++;
+                start_ = std::chrono::steady_clock::now();
+                play();
+            });
+    }
+
+private:
+    void play()
+    {
+        if (!client_->playing())
+            return finish(false);
+        bool last = next_ == session_.play.size();
+        auto self = shared_from_this();
+        timer_.expires_at(at(last ? session_.end : session_.play[next_].time));
+        timer_.async_wait([this, self, last](const boost::system::error_code& e)
+            {
+                if (e || last)
+                    return finish(!e && client_->playing());
+                client_->send(session_.play[next_++].packet);
+                totals_.replayed++;
+                play();
+            });
+    }
+
+    std::chrono::steady_clock::time_point at(uint64_t time) const
+    {
+        return start_ + std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(time) / speed_));
+    }
+
+    void finish(bool ok)
+    {
+        totals_.failed += !ok;
+        totals_.frames += client_->frames_received();
+        totals_.bytes += client_->bytes_received();
+        client_->close();
+        totals_.running--;
+    }
+
+    std::shared_ptr<sim_client> client_;
+    const session& session_;
+    double speed_;
+    boost::asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point start_;
+    size_t next_;
+    totals& totals_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: bench_replay <capture file> [clients] [speed] [port]" << std::endl;
+        return 2;
+    }
+    size_t clients = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    double speed = argc > 3 ? std::strtod(argv[3], nullptr) : 1;
+    std::string port = argc > 4 ? argv[4] : "25581";
+
+    uint64_t records;
+    std::vector<session> templates = load(argv[1], records);
+    size_t play_packets = 0;
+    for (auto& s : templates)
+        play_packets += s.play.size();
+    std::cout << argv[1] << ": " << records << " records, " << templates.size() << " connections to replay, "
+        << play_packets << " play packets" << std::endl;
+    if (templates.empty())
+        return 1;
+
+    // The server like main sets it up, on one io thread, without admission control
+    stub_session_service sessions;
+    authenticator auth{sessions};
+    world w{1, compression_config{256, 3, 1}, &auth};
+    w.start();
+    io_service_pool io_pool{1};
+    server<connection, world*> s{io_pool, "127.0.0.1", port, &w};
+    boost::thread server_thread{[&io_pool] { io_pool.run(); }};
+
+    boost::asio::io_service io;
+    tcp::endpoint endpoint{boost::asio::ip::address::from_string("127.0.0.1"),
+        static_cast<unsigned short>(std::stoi(port))};
+    totals t;
+    std::vector<std::unique_ptr<boost::asio::steady_timer>> starts;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < clients; i++)
+    {
+        auto r = std::make_shared<replayer>(io, endpoint, templates[i % templates.size()], speed, t);
+        starts.emplace_back(new boost::asio::steady_timer{io, begin + std::chrono::microseconds(i * 1000000 / clients)});
+        starts.back()->async_wait([r, i](const boost::system::error_code&) { r->start(i); });
+    }
+
+    // Done when every client is
+    boost::asio::steady_timer poll{io};
+    std::function<void()> wait_done = [&]
+        {
+            poll.expires_from_now(std::chrono::milliseconds(10));
+            poll.async_wait([&](const boost::system::error_code&)
+                {
+                    if (t.running == 0 && t.pings + t.logins + t.failed >= clients)
+                        io.stop();
+                    else
+                        wait_done();
+                });
+        };
+    wait_done();
+    io.run();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    io_pool.stop();
+    server_thread.join();
+    w.stop();
+
+    std::cout << clients << " clients in " << elapsed << " s: " << t.logins << " logins, " << t.pings << " pings, "
+        << t.failed << " failed" << std::endl;
+    std::cout << "sent " << t.replayed << " play packets (" << static_cast<uint64_t>(t.replayed / elapsed)
+        << "/s), received " << t.frames << " frames (" << static_cast<uint64_t>(t.frames / elapsed) << "/s), "
+        << t.bytes / 1024 << " KiB" << std::endl;
+    return t.failed ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Stress test and throughput comparison for the connection send queue. A number
+// of producer threads push sequence numbers into one queue while a single
+// consumer drains it, like world ticks and io threads sending to one connection.
+// The consumer checks that nothing is lost or reordered per producer.
+//
+// mutex:     a vector guarded by a boost::mutex that the consumer swaps out,
+//            the send queue the connection used before
+// mpsc:      the lock free mpsc_queue
+//
+// usage: bench_send_queue [producers] [items per producer]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <misc/mpsc_queue.hpp>
+
+namespace
+{
+
+class mutex_queue
+{
+public:
+    void push(uint64_t value)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        queue_.push_back(value);
+    }
+
+    template <typename F>
+    size_t drain(F f)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            std::swap(queue_, buffer_);
+        }
+        for (uint64_t v : buffer_)
+            f(v);
+        size_t n = buffer_.size();
+        buffer_.clear();
+        return n;
+    }
+
+private:
+    boost::mutex mutex_;
+    std::vector<uint64_t> queue_;
+    std::vector<uint64_t> buffer_;
+};
+
+class lock_free_queue
+{
+public:
+    void push(uint64_t value)
+    {
+        queue_.push(value);
+    }
+
+    template <typename F>
+    size_t drain(F f)
+    {
+        size_t n = 0;
+        uint64_t v;
+        while (queue_.pop(v))
+        {
+            f(v);
+            n++;
+        }
+        return n;
+    }
+
+private:
+    mpsc_queue<uint64_t> queue_;
+};
+
+template <typename Q>
+void produce(Q& queue, uint64_t producer, uint64_t items)
+{
+    for (uint64_t i = 0; i < items; i++)
+        queue.push(producer << 32 | i);
+}
+
+template <typename Q>
+bool run(const std::string& name, size_t producers, uint64_t items)
+{
+    Q queue;
+    std::vector<uint64_t> expected(producers, 0);
+    bool ordered = true;
+
+    auto start = std::chrono::steady_clock::now();
+    boost::thread_group threads;
+    for (size_t p = 0; p < producers; p++)
+        threads.create_thread(boost::bind(&produce<Q>, boost::ref(queue), p, items));
+
+    uint64_t total = producers * items;
+    uint64_t received = 0;
+    while (received < total)
+    {
+        received += queue.drain([&](uint64_t v)
+        {
+            uint64_t producer = v >> 32;
+            uint64_t seq = v & 0xFFFFFFFF;
+            if (producer >= producers || seq != expected[producer])
+                ordered = false;
+            else
+                expected[producer]++;
+        });
+    }
+    threads.join_all();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    bool complete = queue.drain([](uint64_t) {}) == 0;
+    for (uint64_t e : expected)
+        complete = complete && e == items;
+
+    std::cout << name << ": " << producers << " producers, " << total << " items in "
+        << elapsed.count() << " s, " << static_cast<uint64_t>(total / elapsed.count())
+        << " items/s" << (ordered && complete ? "" : " FAILED: items lost or reordered")
+        << std::endl;
+    return ordered && complete;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t producers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8;
+    uint64_t items = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+
+    bool ok = true;
+    for (size_t p = 1; p <= producers; p *= 2)
+    {
+        ok = run<mutex_queue>("mutex (before)", p, items) && ok;
+        ok = run<lock_free_queue>("mpsc (after)  ", p, items) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Server list pings per second against a server with a single io thread. Every
+// ping is a new connection that sends handshake, status request and ping in one
+// go and reads until the server closes the connection, like a launcher or a
+// scanner does. The clients run in this process on a thread of their own, on a
+// machine with few cores they compete with the server for the CPU.
+//
+// usage: bench_status_ping [seconds] [concurrent pings] [port]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <connection/connection.hpp>
+#include <protocol/packets.hpp>
+#include <server/io_service_pool.hpp>
+#include <server/server.hpp>
+#include <world/world.hpp>
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+std::vector<uint8_t> ping_exchange()
+{
+    packets::handshaking::handshake handshake;
+    handshake.protocol = 47;
+    handshake.host = byte_array{reinterpret_cast<const uint8_t*>("localhost"), 9};
+    handshake.port = 25565;
+    handshake.next_state = 1;
+
+    std::vector<packet_ptr> packets{
+        make_packet(handshake),
+        make_packet(packets::status::request{}),
+        make_packet(packets::status::ping{12345})};
+
+    std::vector<uint8_t> bytes;
+    for (auto& p : packets)
+    {
+        p->frame();
+        bytes.insert(bytes.end(), p->header(), p->header() + p->header_size());
+        bytes.insert(bytes.end(), p->body(), p->body() + p->body_size());
+    }
+    return bytes;
+}
+
+// true if data is a status response followed by the pong
+bool valid_answer(const std::vector<uint8_t>& data)
+{
+    byte_view view{data.data(), data.size()};
+    try
+    {
+        varint<size_t> size;
+        varint<unsigned int> id;
+        std::string json;
+        view >> size >> id >> json;
+        if (id != packets::status::response::id || json.find("\"online\"") == std::string::npos)
+            return false;
+
+        int64_t payload;
+        view >> size >> id >> payload;
+        return id == packets::status::ping::id && payload == 12345 && view.pos() == view.size();
+    }
+    catch (std::exception&)
+    {
+        return false;
+    }
+}
+
+class pinger
+{
+public:
+    pinger(boost::asio::io_service& io, const tcp::endpoint& server, const std::vector<uint8_t>& request,
+            size_t& done, size_t& failed) :
+        io_(io), socket_(io), server_(server), request_(request), done_(done), failed_(failed)
+    {
+    }
+
+    void start()
+    {
+        socket_ = tcp::socket(io_);
+        answer_.clear();
+        socket_.async_connect(server_, boost::bind(&pinger::handle_connect, this, boost::asio::placeholders::error));
+    }
+
+private:
+    void handle_connect(const boost::system::error_code& e)
+    {
+        if (e)
+            return finish(false);
+        boost::asio::async_write(socket_, boost::asio::buffer(request_),
+            boost::bind(&pinger::handle_write, this, boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code& e)
+    {
+        if (e)
+            return finish(false);
+        read();
+    }
+
+    void read()
+    {
+        socket_.async_read_some(boost::asio::buffer(buffer_),
+            boost::bind(&pinger::handle_read, this, boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+    }
+
+    void handle_read(const boost::system::error_code& e, size_t bytes)
+    {
+        answer_.insert(answer_.end(), buffer_, buffer_ + bytes);
+        if (e == boost::asio::error::eof)
+            return finish(valid_answer(answer_));
+        if (e)
+            return finish(false);
+        read();
+    }
+
+    void finish(bool ok)
+    {
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        if (ok)
+            done_++;
+        else
+            failed_++;
+        start();
+    }
+
+    boost::asio::io_service& io_;
+    tcp::socket socket_;
+    tcp::endpoint server_;
+    const std::vector<uint8_t>& request_;
+    size_t& done_;
+    size_t& failed_;
+    uint8_t buffer_[512];
+    std::vector<uint8_t> answer_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 3;
+    size_t concurrency = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    std::string port = argc > 3 ? argv[3] : "25580";
+
+    world w;
+    io_service_pool io_pool{1};
+    server<connection, world*> s{io_pool, "127.0.0.1", port, &w};
+    boost::thread server_thread{[&io_pool] { io_pool.run(); }};
+
+    boost::asio::io_service io;
+    tcp::endpoint endpoint{boost::asio::ip::address::from_string("127.0.0.1"),
+        static_cast<unsigned short>(std::stoi(port))};
+    std::vector<uint8_t> request = ping_exchange();
+    size_t done = 0, failed = 0;
+    std::vector<std::unique_ptr<pinger>> pingers;
+    for (size_t i = 0; i < concurrency; i++)
+    {
+        pingers.emplace_back(new pinger{io, endpoint, request, done, failed});
+        pingers.back()->start();
+    }
+
+    boost::asio::deadline_timer timer{io, boost::posix_time::microseconds(static_cast<int64_t>(seconds * 1e6))};
+    timer.async_wait([&io](const boost::system::error_code&) { io.stop(); });
+    auto start = std::chrono::steady_clock::now();
+    io.run();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    io_pool.stop();
+    server_thread.join();
+
+    std::cout << concurrency << " concurrent: " << static_cast<double>(done) / elapsed << " pings/s, "
+        << failed << " failed, status response built " << w.status().builds() << " times" << std::endl;
+    return failed ? 1 : 0;
+}
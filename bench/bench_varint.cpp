@@ -0,0 +1,239 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks varint_codec against a plain reference decoder and measures it against
+// decoding byte by byte with varint::append_byte and encoding with one
+// byte_stream::write per byte, the way VarInts were handled before.
+//
+// fuzz:   random values round trip through every decode path (with and without
+//         8 bytes available), every truncation of an encoding asks for more
+//         bytes, and random byte strings decode exactly like the reference does,
+//         including rejecting overlong VarInts
+// decode: a buffer of VarInts with 1 byte values (ids, small lengths) and one
+//         with values of 1 to 5 bytes
+// encode: the same values into a byte_stream
+//
+// usage: bench_varint [million values]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <protocol/byte_stream.hpp>
+#include <protocol/varint.hpp>
+
+namespace
+{
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The protocol spelled out: -1 if too long, 0 if incomplete, else the length
+int reference_decode(const uint8_t* p, size_t available, size_t max_bytes, uint64_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < max_bytes; i++)
+    {
+        if (i == available)
+            return 0;
+        if (i < 10)
+            value |= static_cast<uint64_t>(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80))
+            return static_cast<int>(i + 1);
+    }
+    return -1;
+}
+
+int codec_decode(const uint8_t* p, size_t available, size_t max_bytes, uint64_t& value)
+{
+    try
+    {
+        return static_cast<int>(varint_codec::decode(p, available, max_bytes, value));
+    }
+    catch (std::runtime_error&)
+    {
+        return -1;
+    }
+}
+
+uint64_t random_value(std::mt19937_64& random)
+{
+    // Every length equally likely
+    int bits = static_cast<int>(random() % 64) + 1;
+    return random() >> (64 - bits);
+}
+
+size_t fuzz(size_t rounds)
+{
+    std::mt19937_64 random{7};
+    size_t failures = 0;
+    uint8_t buffer[16];
+
+    for (size_t i = 0; i < rounds; i++)
+    {
+        // Round trip, with the VarInt at the end of the data and with padding
+        uint64_t value = random_value(random);
+        size_t len = varint_codec::size(value);
+        if (varint_codec::encode(buffer, value) != buffer + len)
+            failures++;
+        for (size_t pad = len; pad < 16; pad++)
+            buffer[pad] = static_cast<uint8_t>(random());
+        for (size_t available : {len, size_t(16)})
+        {
+            uint64_t decoded = 0;
+            if (codec_decode(buffer, available, 10, decoded) != static_cast<int>(len) || decoded != value)
+                failures++;
+        }
+
+        // The old decoder agrees for the values that fit in 32 bits
+        if (value <= 0xFFFFFFFF)
+        {
+            varint<uint32_t> old;
+            size_t n = 0;
+            while (old.append_byte(buffer[n], static_cast<int>(n)))
+                n++;
+            if (old != value)
+                failures++;
+        }
+
+        // Truncated, we need more bytes
+        for (size_t cut = 0; cut < len; cut++)
+        {
+            uint64_t decoded = 0;
+            if (codec_decode(buffer, cut, 10, decoded) != 0)
+                failures++;
+        }
+
+        // Random bytes, biased to continuation bits so overlong VarInts show up
+        size_t available = random() % 13;
+        for (size_t b = 0; b < available; b++)
+            buffer[b] = static_cast<uint8_t>(random() | (random() % 4 ? 0x80 : 0));
+        size_t max_bytes = random() % 2 ? 5 : 10;
+        uint64_t expected = 0, decoded = 0;
+        int expected_len = reference_decode(buffer, available, max_bytes, expected);
+        int len_decoded = codec_decode(buffer, available, max_bytes, decoded);
+        if (len_decoded != expected_len || (expected_len > 0 && decoded != expected))
+            failures++;
+    }
+    return failures;
+}
+
+std::vector<uint8_t> encode_all(const std::vector<uint32_t>& values)
+{
+    byte_stream out(values.size() * 5);
+    for (uint32_t v : values)
+        out << varint<uint32_t>(v);
+    return std::vector<uint8_t>(out.data(), out.data() + out.size());
+}
+
+void measure(const std::string& name, const std::vector<uint32_t>& values)
+{
+    std::vector<uint8_t> data = encode_all(values);
+    double mb = static_cast<double>(values.size()) / 1e6;
+
+    // Byte by byte with a bounds check per byte, like byte_view used to
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum_old = 0;
+    for (size_t pos = 0; pos < data.size(); )
+    {
+        varint<uint32_t> v;
+        for (int i = 0; ; i++)
+        {
+            if (pos == data.size())
+                throw std::runtime_error("past the end");
+            if (!v.append_byte(data[pos++], i))
+                break;
+        }
+        sum_old += v;
+    }
+    double old_decode = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t sum_new = 0;
+    for (size_t pos = 0; pos < data.size(); )
+    {
+        uint32_t v = 0;
+        pos += varint_codec::decode(data.data() + pos, data.size() - pos, v);
+        sum_new += v;
+    }
+    double new_decode = seconds_since(start);
+
+    // One write per byte into a byte_stream, like operator<< used to
+    byte_stream out(data.size());
+    start = std::chrono::steady_clock::now();
+    for (uint32_t value : values)
+    {
+        uint8_t byte;
+        while (value >= 0x80)
+        {
+            byte = static_cast<uint8_t>(value & 0x7F) | 0x80;
+            value >>= 7;
+            out.write(&byte, 1);
+        }
+        byte = static_cast<uint8_t>(value);
+        out.write(&byte, 1);
+    }
+    double old_encode = seconds_since(start);
+    bool same = std::vector<uint8_t>(out.data(), out.data() + out.size()) == data;
+
+    out.clear();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t value : values)
+        out << varint<uint32_t>(value);
+    double new_encode = seconds_since(start);
+    same = same && std::vector<uint8_t>(out.data(), out.data() + out.size()) == data;
+
+    std::cout << name << ": decode " << mb / old_decode << " -> " << mb / new_decode << " M/s, encode "
+        << mb / old_encode << " -> " << mb / new_encode << " M/s"
+        << (sum_old == sum_new && same ? "" : ", MISMATCH") << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t millions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10;
+    size_t count = millions * 1000 * 1000;
+
+#if defined(__BMI2__)
+    std::cout << "compact: PEXT" << std::endl;
+#else
+    std::cout << "compact: shifts" << std::endl;
+#endif
+
+    size_t failures = fuzz(count / 10);
+    std::cout << "fuzz: " << count / 10 << " rounds, " << failures << " failures" << std::endl;
+
+    std::mt19937 random{1};
+    std::vector<uint32_t> small(count), mixed(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        small[i] = random() % 0x80;
+        mixed[i] = random() >> (random() % 32);
+    }
+    measure("1 byte", small);
+    measure("1-5 bytes", mixed);
+
+    return failures ? 1 : 0;
+}
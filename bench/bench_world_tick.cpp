@@ -0,0 +1,91 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Ticks a world full of wandering entities standing in for players, spread over
+// a grid of regions, with 1, 2, 4, ... threads up to the number of cores. The
+// entities start at the same positions for every thread count.
+//
+// usage: bench_world_tick [entities] [ticks] [max threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include <boost/thread.hpp>
+
+#include <world/world.hpp>
+
+namespace
+{
+
+// The entities are spread over grid_size x grid_size regions
+constexpr int grid_size = 8;
+
+double run(size_t threads, size_t entities, size_t ticks)
+{
+    world w{threads};
+    std::mt19937 random{42};
+    std::uniform_real_distribution<double> position(0, grid_size * world::region_size);
+    std::uniform_real_distribution<double> direction(0, 2 * M_PI);
+
+    for (size_t i = 0; i < entities; i++)
+    {
+        entity e = entity();
+        e.id = w.next_entity_id();
+        e.x = position(random);
+        e.y = 64;
+        e.z = position(random);
+        double d = direction(random);
+        e.vx = std::cos(d) * 0.1;
+        e.vz = std::sin(d) * 0.1;
+        w.add_entity(e);
+    }
+    w.tick();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ticks; i++)
+        w.tick();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    tick_timings t = w.timings();
+    std::cout << threads << " threads: " << ticks << " ticks in " << elapsed.count() << " s, "
+        << elapsed.count() * 1e6 / static_cast<double>(ticks) << " us per tick, last tick "
+        << t.regions << " regions, " << t.border_entities << " border entities, " << t.handoffs
+        << " hand-offs" << std::endl;
+    return elapsed.count();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t entities = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    size_t ticks = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+    size_t cores = argc > 3 ? std::strtoul(argv[3], nullptr, 10)
+        : std::max(1u, boost::thread::hardware_concurrency());
+
+    double base = run(1, entities, ticks);
+    for (size_t threads = 2; threads <= cores; threads *= 2)
+    {
+        double elapsed = run(threads, entities, ticks);
+        std::cout << "  speedup " << base / elapsed << std::endl;
+    }
+}
@@ -0,0 +1,384 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// A protocol 47 client for the load benchmarks. It pings the server list or
+// logs in (with encryption and compression if the server asks for them), and in
+// play it answers keep alives and sends what it's told to. Play packets from the
+// server are only counted, not decoded.
+//
+// A sim_client runs on one io_service, its handlers must not run on more than
+// one thread at a time.
+
+#ifndef BARIUMSULFATE__BENCH__SIM_CLIENT_HPP
+#define BARIUMSULFATE__BENCH__SIM_CLIENT_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <protocol/byte_view.hpp>
+#include <protocol/cfb8.hpp>
+#include <protocol/compression.hpp>
+#include <protocol/packets.hpp>
+#include <protocol/schema.hpp>
+#include <protocol/varint.hpp>
+
+// A packet as id and fields, without frame
+typedef std::vector<uint8_t> sim_packet;
+
+template <typename P>
+sim_packet encode_packet(const P& p)
+{
+    packet_ptr packet = make_packet(p);
+    return sim_packet(packet->data(), packet->data() + packet->size());
+}
+
+class sim_client : public std::enable_shared_from_this<sim_client>, private boost::noncopyable
+{
+public:
+    typedef boost::asio::ip::tcp tcp;
+    // Called once, with true when the ping was answered or the login succeeded
+    typedef std::function<void(bool)> done_handler;
+
+    sim_client(boost::asio::io_service& io, const tcp::endpoint& server) :
+        socket_(io), server_(server), state_(state::idle), compression_(-1), writing_(false),
+        frames_received_(0), bytes_received_(0), packets_sent_(0)
+    {
+    }
+
+    // Handshake, status request and ping, done when the pong is there
+    void status_ping(done_handler done)
+    {
+        start(state::status, std::move(done), [this]
+            {
+                send(handshake(1));
+                send(encode_packet(packets::status::request{}));
+                send(encode_packet(packets::status::ping{12345}));
+            });
+    }
+
+    // Handshake and login start, done when the login succeeded
+    void login(const std::string& username, done_handler done)
+    {
+        start(state::login, std::move(done), [this, username]
+            {
+                send(handshake(2));
+                send(encode_packet(packets::login::start{username}));
+            });
+    }
+
+    // Sends a packet, framed, compressed and encrypted the way the connection is
+    void send(const sim_packet& packet)
+    {
+        if (state_ == state::closed)
+            return;
+
+        std::vector<uint8_t> frame;
+        if (compression_ < 0)
+            frame.assign(packet.begin(), packet.end());
+        else if (packet.size() < static_cast<size_t>(compression_))
+        {
+            frame.push_back(0);
+            frame.insert(frame.end(), packet.begin(), packet.end());
+        }
+        else
+        {
+            varint<size_t>::bytes(packet.size(), frame);
+            std::vector<uint8_t> compressed;
+            compress(packet.data(), packet.size(), 1, compressed);
+            frame.insert(frame.end(), compressed.begin(), compressed.end());
+        }
+
+        size_t start = next_.size();
+        varint<size_t>::bytes(frame.size(), next_);
+        next_.insert(next_.end(), frame.begin(), frame.end());
+        if (encrypt_)
+            encrypt_->apply(&next_[start], &next_[start], next_.size() - start);
+        packets_sent_++;
+        write();
+    }
+
+    void close()
+    {
+        finish(false);
+    }
+
+    bool playing() const
+    {
+        return state_ == state::play;
+    }
+
+    uint64_t frames_received() const
+    {
+        return frames_received_;
+    }
+
+    // On the wire, so compressed
+    uint64_t bytes_received() const
+    {
+        return bytes_received_;
+    }
+
+    uint64_t packets_sent() const
+    {
+        return packets_sent_;
+    }
+
+private:
+    enum class state {idle, status, login, play, closed};
+
+    template <typename F>
+    void start(state s, done_handler done, F first_packets)
+    {
+        state_ = s;
+        done_ = std::move(done);
+        auto self = shared_from_this();
+        socket_.async_connect(server_, [this, self, first_packets](const boost::system::error_code& e)
+            {
+                if (e)
+                    return finish(false);
+                boost::system::error_code ignored;
+                socket_.set_option(tcp::no_delay(true), ignored);
+                first_packets();
+                read();
+            });
+    }
+
+    sim_packet handshake(int next_state) const
+    {
+        packets::handshaking::handshake h;
+        h.protocol = 47;
+        h.host = byte_array{reinterpret_cast<const uint8_t*>("localhost"), 9};
+        h.port = server_.port();
+        h.next_state = next_state;
+        return encode_packet(h);
+    }
+
+    void write()
+    {
+        if (writing_ || next_.empty() || state_ == state::closed)
+            return;
+        writing_ = true;
+        out_.swap(next_);
+        next_.clear();
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(out_),
+            [this, self](const boost::system::error_code& e, size_t)
+            {
+                writing_ = false;
+                if (e)
+                    return finish(false);
+                write();
+            });
+    }
+
+    void read()
+    {
+        auto self = shared_from_this();
+        socket_.async_read_some(boost::asio::buffer(buffer_),
+            [this, self](const boost::system::error_code& e, size_t bytes)
+            {
+                if (e)
+                    return finish(state_ == state::play && e == boost::asio::error::eof);
+                bytes_received_ += bytes;
+                if (decrypt_)
+                    decrypt_->apply(buffer_, buffer_, bytes);
+                pending_.insert(pending_.end(), buffer_, buffer_ + bytes);
+                try
+                {
+                    handle_frames();
+                }
+                catch (std::exception&)
+                {
+                    return finish(false);
+                }
+                if (state_ != state::closed)
+                    read();
+            });
+    }
+
+    void handle_frames()
+    {
+        size_t pos = 0;
+        while (state_ != state::closed && pos < pending_.size())
+        {
+            uint64_t size = 0;
+            size_t header = varint_codec::decode(&pending_[0] + pos, pending_.size() - pos, 3, size);
+            if (!header || pending_.size() - pos - header < size)
+                break;
+            pos += header;
+            const uint8_t* frame = &pending_[pos];
+            pos += size;
+            frames_received_++;
+
+            // Compressed packets are never ones this client looks into
+            if (compression_ >= 0)
+            {
+                uint64_t uncompressed = 0;
+                size_t n = varint_codec::decode(frame, size, 5, uncompressed);
+                if (!n)
+                    throw std::runtime_error("frame too short.");
+                if (uncompressed)
+                    continue;
+                frame += n;
+                size -= n;
+            }
+
+            byte_view packet{frame, size};
+            varint<unsigned int> id;
+            packet >> id;
+            bool decrypting = static_cast<bool>(decrypt_);
+            handle_packet(id, packet);
+
+            // Whatever follows the encryption request is encrypted
+            if (!decrypting && decrypt_)
+                decrypt_->apply(&pending_[0] + pos, &pending_[0] + pos, pending_.size() - pos);
+        }
+        pending_.erase(pending_.begin(), pending_.begin() + pos);
+    }
+
+    void handle_packet(unsigned int id, byte_view& packet)
+    {
+        switch (state_)
+        {
+        case state::status:
+            if (id == packets::status::ping::id)
+                finish(true);
+            break;
+
+        case state::login:
+            if (id == packets::login::encryption_request::id)
+                answer_encryption(packet);
+            else if (id == packets::login::set_compression::id)
+            {
+                packets::login::set_compression c;
+                decode(packet, c);
+                compression_ = c.threshold;
+            }
+            else if (id == packets::login::success::id)
+            {
+                state_ = state::play;
+                done_handler done;
+                done.swap(done_);
+                done(true);
+            }
+            else
+                finish(false);
+            break;
+
+        case state::play:
+            if (id == packets::play::keep_alive::id)
+            {
+                packets::play::keep_alive k;
+                decode(packet, k);
+                send(encode_packet(k));
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void answer_encryption(byte_view& packet)
+    {
+        packets::login::encryption_request request;
+        decode(packet, request);
+
+        uint8_t secret[cfb8::key_size];
+        if (RAND_bytes(secret, sizeof(secret)) != 1)
+            throw std::runtime_error("RAND_bytes failed.");
+
+        const uint8_t* key = request.public_key.data;
+        EVP_PKEY* pkey = d2i_PUBKEY(nullptr, &key, static_cast<long>(request.public_key.size));
+        if (!pkey)
+            throw std::runtime_error("bad public key.");
+        std::vector<uint8_t> encrypted_secret = rsa_encrypt(pkey, secret, sizeof(secret));
+        std::vector<uint8_t> encrypted_token = rsa_encrypt(pkey, request.verify_token.data, request.verify_token.size);
+        EVP_PKEY_free(pkey);
+
+        packets::login::encryption_response response;
+        response.shared_secret = byte_array{encrypted_secret.data(), encrypted_secret.size()};
+        response.verify_token = byte_array{encrypted_token.data(), encrypted_token.size()};
+        send(encode_packet(response));
+
+        encrypt_.reset(new cfb8{secret, cfb8::mode::encrypt});
+        decrypt_.reset(new cfb8{secret, cfb8::mode::decrypt});
+    }
+
+    static std::vector<uint8_t> rsa_encrypt(EVP_PKEY* key, const uint8_t* data, size_t size)
+    {
+        std::vector<uint8_t> out(EVP_PKEY_get_size(key));
+        size_t out_size = out.size();
+        EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(key, nullptr);
+        bool ok = ctx && EVP_PKEY_encrypt_init(ctx) == 1 &&
+            EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) == 1 &&
+            EVP_PKEY_encrypt(ctx, out.data(), &out_size, data, size) == 1;
+        EVP_PKEY_CTX_free(ctx);
+        if (!ok)
+            throw std::runtime_error("RSA encryption failed.");
+        out.resize(out_size);
+        return out;
+    }
+
+    void finish(bool ok)
+    {
+        if (state_ == state::closed)
+            return;
+        state_ = state::closed;
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        done_handler done;
+        done.swap(done_);
+        if (done)
+            done(ok);
+    }
+
+    tcp::socket socket_;
+    tcp::endpoint server_;
+    state state_;
+    done_handler done_;
+    int compression_;  // threshold, -1 until the server sets compression
+    std::unique_ptr<cfb8> encrypt_;
+    std::unique_ptr<cfb8> decrypt_;
+
+    uint8_t buffer_[16384];
+    std::vector<uint8_t> pending_;  // decrypted bytes of frames that aren't complete yet
+
+    // out_ is being written, next_ collects what's sent in the meantime
+    bool writing_;
+    std::vector<uint8_t> out_;
+    std::vector<uint8_t> next_;
+
+    uint64_t frames_received_;
+    uint64_t bytes_received_;
+    uint64_t packets_sent_;
+};
+
+#endif
@@ -0,0 +1,188 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <connection/authenticator.hpp>
+
+namespace
+{
+
+struct pkey_ctx_deleter
+{
+    void operator()(EVP_PKEY_CTX* ctx) const
+    {
+        EVP_PKEY_CTX_free(ctx);
+    }
+};
+
+typedef std::unique_ptr<EVP_PKEY_CTX, pkey_ctx_deleter> pkey_ctx_ptr;
+
+std::string format_uuid(const uint8_t* b)
+{
+    char s[37];
+    std::snprintf(s, sizeof(s),
+        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+        b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+    return s;
+}
+
+}
+
+std::string offline_uuid(const std::string& name)
+{
+    std::string input = "OfflinePlayer:" + name;
+    uint8_t hash[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    if (!EVP_Digest(input.data(), input.size(), hash, &size, EVP_md5(), nullptr))
+        throw std::runtime_error("Could not hash the player name.");
+
+    hash[6] = (hash[6] & 0x0f) | 0x30;  // version 3
+    hash[8] = (hash[8] & 0x3f) | 0x80;  // IETF variant
+    return format_uuid(hash);
+}
+
+stub_session_service::stub_session_service(bool strict) :
+    strict_{strict}
+{
+}
+
+void stub_session_service::join(const std::string& username, const std::string& server_hash)
+{
+    boost::mutex::scoped_lock lock{mutex_};
+    joined_[username] = server_hash;
+}
+
+bool stub_session_service::has_joined(const std::string& username, const std::string& server_hash, game_profile& profile)
+{
+    if (strict_)
+    {
+        boost::mutex::scoped_lock lock{mutex_};
+        auto it = joined_.find(username);
+        if (it == joined_.end() || it->second != server_hash)
+            return false;
+        joined_.erase(it);
+    }
+
+    profile.uuid = offline_uuid(username);
+    profile.name = username;
+    return true;
+}
+
+constexpr int authenticator::key_bits;
+constexpr size_t authenticator::verify_token_size;
+
+authenticator::authenticator(session_service& sessions, const std::string& server_id) :
+    sessions_(sessions), server_id_{server_id}, key_{nullptr}
+{
+    pkey_ctx_ptr ctx{EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr)};
+    if (!ctx || EVP_PKEY_keygen_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), key_bits) <= 0 ||
+        EVP_PKEY_keygen(ctx.get(), &key_) <= 0)
+        throw std::runtime_error("Could not generate the RSA key.");
+
+    int size = i2d_PUBKEY(key_, nullptr);
+    if (size <= 0)
+    {
+        EVP_PKEY_free(key_);
+        throw std::runtime_error("Could not encode the RSA public key.");
+    }
+    public_key_.resize(size);
+    uint8_t* out = public_key_.data();
+    i2d_PUBKEY(key_, &out);
+}
+
+authenticator::~authenticator()
+{
+    EVP_PKEY_free(key_);
+}
+
+std::array<uint8_t, authenticator::verify_token_size> authenticator::verify_token() const
+{
+    std::array<uint8_t, verify_token_size> token;
+    if (RAND_bytes(token.data(), token.size()) != 1)
+        throw std::runtime_error("Could not generate a verify token.");
+    return token;
+}
+
+std::vector<uint8_t> authenticator::decrypt(const uint8_t* data, size_t size) const
+{
+    pkey_ctx_ptr ctx{EVP_PKEY_CTX_new(key_, nullptr)};
+    size_t out_size = 0;
+    if (!ctx || EVP_PKEY_decrypt_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PADDING) <= 0 ||
+        EVP_PKEY_decrypt(ctx.get(), nullptr, &out_size, data, size) <= 0)
+        throw std::runtime_error("Could not set up RSA decryption.");
+
+    std::vector<uint8_t> out(out_size);
+    if (EVP_PKEY_decrypt(ctx.get(), out.data(), &out_size, data, size) <= 0)
+        throw std::runtime_error("Could not decrypt RSA encrypted data.");
+    out.resize(out_size);
+    return out;
+}
+
+// Java's BigInteger(digest).toString(16): a negative digest is printed as minus
+// its two's complement, leading zeros are left out.
+std::string authenticator::server_hash(const std::vector<uint8_t>& secret) const
+{
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    uint8_t hash[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    bool ok = ctx && EVP_DigestInit_ex(ctx, EVP_sha1(), nullptr) &&
+        EVP_DigestUpdate(ctx, server_id_.data(), server_id_.size()) &&
+        EVP_DigestUpdate(ctx, secret.data(), secret.size()) &&
+        EVP_DigestUpdate(ctx, public_key_.data(), public_key_.size()) &&
+        EVP_DigestFinal_ex(ctx, hash, &size);
+    EVP_MD_CTX_free(ctx);
+    if (!ok)
+        throw std::runtime_error("Could not compute the server hash.");
+
+    bool negative = (hash[0] & 0x80) != 0;
+    if (negative)
+    {
+        bool carry = true;
+        for (int i = static_cast<int>(size) - 1; i >= 0; i--)
+        {
+            hash[i] = static_cast<uint8_t>(~hash[i] + (carry ? 1 : 0));
+            carry = carry && hash[i] == 0;
+        }
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned int i = 0; i < size; i++)
+    {
+        hex += digits[hash[i] >> 4];
+        hex += digits[hash[i] & 0x0f];
+    }
+    size_t first = hex.find_first_not_of('0');
+    hex = first == std::string::npos ? "0" : hex.substr(first);
+    return negative ? "-" + hex : hex;
+}
+
+bool authenticator::verify(const std::string& username, const std::vector<uint8_t>& secret, game_profile& profile) const
+{
+    return sessions_.has_joined(username, server_hash(secret), profile);
+}
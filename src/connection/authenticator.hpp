@@ -0,0 +1,125 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__CONNECTION__AUTHENTICATOR_HPP
+#define BARIUMSULFATE__CONNECTION__AUTHENTICATOR_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+typedef struct evp_pkey_st EVP_PKEY;
+
+// Who a player is according to the session service
+struct game_profile
+{
+    std::string uuid;
+    std::string name;
+};
+
+// The UUID of a player on an offline mode server, version 3 from
+// "OfflinePlayer:<name>"
+std::string offline_uuid(const std::string& name);
+
+// Tells whether a player told the session service it joins this server. Called
+// from the io threads, implementations have to be thread safe.
+class session_service
+{
+public:
+    virtual ~session_service()
+    {
+    }
+
+    virtual bool has_joined(const std::string& username, const std::string& server_hash, game_profile& profile) = 0;
+};
+
+/**
+ * A session service that doesn't leave the process. In strict mode only the joins
+ * registered with join() are accepted, each once and only with the server hash
+ * they were registered with, which is what a real session service does. The
+ * server runs it strict. Otherwise it takes every player's word for it and hands
+ * out offline UUIDs, which is only for benchmarks and tools that drive the
+ * server in process.
+ */
+class stub_session_service : public session_service, private boost::noncopyable
+{
+public:
+    explicit stub_session_service(bool strict = false);
+
+    // What the client would tell the session service before answering the
+    // encryption request
+    void join(const std::string& username, const std::string& server_hash);
+
+    bool has_joined(const std::string& username, const std::string& server_hash, game_profile& profile) override;
+
+private:
+    bool strict_;
+    boost::mutex mutex_;
+    std::unordered_map<std::string, std::string> joined_;  // username -> server hash
+};
+
+/**
+ * The server side of the online mode login. It owns the RSA key pair the client
+ * encrypts the shared secret with and checks the client against the session
+ * service. Thread safe, one authenticator serves every connection.
+ */
+class authenticator : private boost::noncopyable
+{
+public:
+    static constexpr int key_bits = 1024;
+    static constexpr size_t verify_token_size = 4;
+
+    explicit authenticator(session_service& sessions, const std::string& server_id = "");
+    ~authenticator();
+
+    const std::string& server_id() const
+    {
+        return server_id_;
+    }
+
+    // The public key in DER (X.509 SubjectPublicKeyInfo) as sent in the
+    // encryption request
+    const std::vector<uint8_t>& public_key() const
+    {
+        return public_key_;
+    }
+
+    std::array<uint8_t, verify_token_size> verify_token() const;
+
+    // Decrypts something the client encrypted with the public key, throws if it
+    // can't be decrypted
+    std::vector<uint8_t> decrypt(const uint8_t* data, size_t size) const;
+
+    // The hash the client and the server give to the session service: the SHA-1
+    // of server id, shared secret and public key as a signed hexadecimal number
+    std::string server_hash(const std::vector<uint8_t>& secret) const;
+
+    bool verify(const std::string& username, const std::vector<uint8_t>& secret, game_profile& profile) const;
+
+private:
+    session_service& sessions_;
+    std::string server_id_;
+    EVP_PKEY* key_;
+    std::vector<uint8_t> public_key_;
+};
+
+#endif
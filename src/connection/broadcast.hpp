@@ -0,0 +1,46 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__CONNECTION__BROADCAST_HPP
+#define BARIUMSULFATE__CONNECTION__BROADCAST_HPP
+
+#include <iterator>
+
+#include <protocol/packet_pool.hpp>
+
+// Sends one packet to a range of connections. The packet is serialized by the
+// caller and framed exactly once by the first connection, every connection then
+// queues a reference to the same immutable buffer. The connections have to agree
+// on compression, see packet_buffer. Use this instead of building the packet for each
+// recipient when it goes out to more than one player (entity movement, chat).
+//
+// Iterator must dereference to something that behaves like a pointer to a
+// connection, e.g. a boost::shared_ptr<connection> or a connection*.
+template <typename Iterator>
+void broadcast(const packet_ptr& packet, Iterator begin, Iterator end, bool force_flush = false)
+{
+    for (; begin != end; ++begin)
+        (*begin)->send(packet, force_flush);
+}
+
+template <typename Range>
+void broadcast(const packet_ptr& packet, Range& connections, bool force_flush = false)
+{
+    broadcast(packet, std::begin(connections), std::end(connections), force_flush);
+}
+
+#endif
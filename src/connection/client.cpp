@@ -15,27 +15,30 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <connection/authenticator.hpp>
 #include <connection/client.hpp>
 #include <connection/connection.hpp>
 #include <misc/log.hpp>
 #include <protocol/handlers.hpp>
 #include <protocol/varint.hpp>
+#include <world/world.hpp>
 
-client::client(connection* con) :
-    connection_(con), state_(state::fresh)
+client::client(connection* con, world* w) :
+    connection_(con), world_(w), state_(state::fresh), dropped_{0}, player_(), chunks_{world::view_distance}
 {
 
 }
 
-void client::add_packet(byte_stream& data)
+void client::add_packet(const packet_view& packet)
 try
 {
+    byte_view data = packet;
     varint<unsigned int> opcode;
     data >> opcode;
     
-    DE(log::debug(log::dbg::connection, connection_->address(),
+    LOG_DEBUG(log::dbg::connection, connection_->address(),
         "received packet with opcode", opcode, "in state",
-        static_cast<int>(state_)));
+        static_cast<int>(state_));
     
     std::vector<handler_info>* handlers = nullptr;
     switch (state_)
@@ -48,60 +51,106 @@ try
 
     if (opcode >= handlers->size())
     {
-        log::error(connection_->address(), "opcode", opcode, "is not valid in state", static_cast<int>(state_));
+        LOG_ERROR(connection_->address(), "opcode", opcode, "is not valid in state", static_cast<int>(state_));
         connection_->shutdown();
         return;
     }
     
     auto info = (*handlers)[opcode];
     if (info.type == handler_type::instant)
-    {
-        auto handler = std::bind(handlers->at(opcode).fn, this, data);
-        handler();
-    }
+        info.fn(*this, data);
     else
+        queue_packet(packet, info.type == handler_type::droppable);
+}
+catch (std::exception& e)
+{
+    LOG_ERROR(connection_->address(), "client::add_packet exception:", e.what(), packet.hexdump());
+    connection_->shutdown();
+}
+
+bool client::next_packet(packet_view& packet)
+{
+    return packets_ && packets_->pop(packet);
+}
+
+size_t client::handle_delayed_packets(size_t max)
+{
+    size_t handled = 0;
+    packet_view packet;
+    while (handled < max && next_packet(packet))
     {
-        boost::lock_guard<boost::mutex> lock(mutex_);
-        data.pos(0);
-        packets_.emplace_back(std::move(data));
+        handled++;
+        try
+        {
+            // The opcode was checked when the packet was queued
+            byte_view data = packet;
+            varint<unsigned int> opcode;
+            data >> opcode;
+            game_handlers[opcode].fn(*this, data);
+        }
+        catch (std::exception& e)
+        {
+            LOG_ERROR(connection_->address(), "client::handle_delayed_packets exception:", e.what(), packet.hexdump());
+            connection_->shutdown();
+        }
     }
+    return handled;
 }
-catch (std::exception& e)
+
+boost::shared_ptr<connection> client::leave_world()
+{
+    boost::shared_ptr<connection> con;
+    con.swap(shared_connection_);
+    return con;
+}
+
+// Hands a packet to the world tick. When a client sends packets faster than the
+// ticks handle them its queue fills up. From then on droppable packets (movement)
+// are dropped, until the client has sent max_dropped_packets of them in a row.
+// Any other packet that doesn't fit disconnects the client right away, as does
+// going over max_dropped_packets.
+void client::queue_packet(const packet_view& packet, bool droppable)
 {
-    log::error(connection_->address(), "client::add_packet exception:", e.what(), data.hexdump());
+    if (packets_ && packets_->push(packet))
+    {
+        dropped_ = 0;
+        return;
+    }
+
+    if (droppable && packets_ && ++dropped_ <= max_dropped_packets)
+    {
+        LOG_DEBUG(log::dbg::connection, connection_->address(), "packet queue full, dropped packet");
+        return;
+    }
+
+    LOG_ERROR(connection_->address(), "flooded its packet queue, disconnecting");
     connection_->shutdown();
 }
 
-void client::unhandled_packet(byte_stream& data)
+void client::unhandled_packet(byte_view& data)
 {
     varint<unsigned int> opcode;
     data.pos(0);
     data >> opcode;
 
-    log::error(connection_->address(), "unhandled packet with opcode", opcode, "in state", static_cast<int>(state_));
+    LOG_ERROR(connection_->address(), "unhandled packet with opcode", opcode, "in state", static_cast<int>(state_));
 }
 
-void client::handle_handshake(byte_stream& data)
+void client::handle_handshake(const packets::handshaking::handshake& packet)
 {
-    varint<int> protocol;
-    std::string host;
-    uint16_t port;
-    varint<int> next_state;
-    
-    data >> protocol >> host >> port >> next_state;
-
-    if (protocol != supported_protocol_version)
+    if (packet.protocol != supported_protocol_version)
     {
         connection_->shutdown();
     }
 
-    switch (next_state)
+    switch (packet.next_state)
     {
     case 1:
         state_ = state::status;
         break;
     case 2:
         state_ = state::login;
+        connection_->set_deadline(connection::login_timeout);
         break;
     default:
         connection_->shutdown();
@@ -109,44 +158,155 @@ void client::handle_handshake(byte_stream& data)
     }
 }
 
-const std::string status_value = R"({"description":"Bariumsulfate","players":{"max":20,"online":0},"version":{"name":"1.8","protocol":47}})";
+// The server list ping: handshake, status request, ping. The response is cached
+// and framed already, the connection is closed as soon as the pong is out.
+void client::handle_status_request(const packets::status::request&)
+{
+    connection_->send(world_->status().response(world_->player_count()));
+}
 
-void client::handle_status_request(byte_stream&)
+void client::handle_status_ping(const packets::status::ping& packet)
 {
-    std::shared_ptr<byte_stream> response{new byte_stream};
-    *response << varint<unsigned int>(0) << status_value;
-    connection_->send(response);
+    connection_->send(make_packet(packet), true);
+    connection_->shutdown();
 }
 
-void client::handle_status_ping(byte_stream& data)
+void client::handle_login_start(const packets::login::start& packet)
 {
-    uint64_t ping_value;
-    data >> ping_value;
+    username_ = packet.username;
     
-    std::shared_ptr<byte_stream> response{new byte_stream};
-    *response << varint<unsigned int>(1) << ping_value;
-    connection_->send(response, true);
+    LOG_INFO(connection_->address(), "login request for user", username_);
+
+    authenticator* auth = world_->get_authenticator();
+    if (!auth)
+    {
+        finish_login(offline_uuid(username_));
+        return;
+    }
+
+    // Online mode, the client proves who it is with the session service and sends
+    // the shared secret for the encryption
+    auto token = auth->verify_token();
+    verify_token_.assign(token.begin(), token.end());
+    const std::vector<uint8_t>& key = auth->public_key();
+
+    packets::login::encryption_request request;
+    request.server_id = auth->server_id();
+    request.public_key = byte_array{key.data(), key.size()};
+    request.verify_token = byte_array{verify_token_.data(), verify_token_.size()};
+    connection_->send(make_packet(request), true);
 }
 
-void client::handle_login_start(byte_stream& data)
+void client::handle_encryption_response(const packets::login::encryption_response& packet)
 {
-    std::string username;
-    data >> username;
-    
-    DE(log::info(connection_->address(), "login request for user", username));
+    authenticator* auth = world_->get_authenticator();
+    if (!auth || verify_token_.empty())
+    {
+        LOG_ERROR(connection_->address(), "sent an encryption response that wasn't asked for");
+        connection_->shutdown();
+        return;
+    }
+
+    std::vector<uint8_t> secret = auth->decrypt(packet.shared_secret.data, packet.shared_secret.size);
+    std::vector<uint8_t> token = auth->decrypt(packet.verify_token.data, packet.verify_token.size);
+    if (token != verify_token_)
+    {
+        LOG_ERROR(connection_->address(), "sent the wrong verify token");
+        connection_->shutdown();
+        return;
+    }
+    verify_token_.clear();
+
+    // Everything after the encryption response is encrypted, both ways. Even the
+    // disconnect below, the client switched already.
+    connection_->enable_encryption(secret);
+
+    game_profile profile;
+    if (!auth->verify(username_, secret, profile))
+    {
+        LOG_INFO(connection_->address(), "failed to verify username", username_);
+        disconnect_login("Failed to verify username!");
+        return;
+    }
+
+    username_ = profile.name;
+    finish_login(profile.uuid);
+}
+
+void client::finish_login(const std::string& uuid)
+{
+    packets_.reset(new spsc_ring<packet_view>{max_delayed_packets});
 
-    std::shared_ptr<byte_stream> response{new byte_stream};
-    *response << varint<unsigned int>(2) << std::string("d99974de-50e1-4861-bb7a-60e0e59cf611") << username;
-    connection_->send(response);
+    // Everything after set compression is in the compressed format, both ways
+    const compression_config& compression = world_->compression();
+    if (compression.enabled())
+    {
+        connection_->send(make_packet(packets::login::set_compression{compression.threshold}));
+        connection_->enable_compression(compression);
+    }
+
+    connection_->send(make_packet(packets::login::success{uuid, username_}));
     
-    std::shared_ptr<byte_stream> join{new byte_stream};
-    *join << varint<unsigned int>(1)    // join game
-        << static_cast<int32_t>(0)      // entity id
-        << static_cast<uint8_t>(0)      // game mode (survival)
-        << static_cast<int8_t>(0)       // dimension (overworld)
-        << static_cast<uint8_t>(0)      // difficulty (peaceful)
-        << static_cast<uint8_t>(10)     // max players
-        << std::string("flat")
-        << true;
-    connection_->send(join);
+    player_.id = world_->next_entity_id();
+    player_.controlled = true;
+
+    packets::play::join_game join;
+    join.entity_id = player_.id;
+    join.game_mode = 0;             // survival
+    join.dimension = 0;             // overworld
+    join.difficulty = 0;            // peaceful
+    join.max_players = 10;
+    join.level_type = "flat";
+    join.reduced_debug_info = true;
+    connection_->send(make_packet(join));
+
+    // From here on the world tick handles our delayed packets and keeps the
+    // connection alive
+    connection_->clear_deadline();
+    state_ = state::world;
+    shared_connection_ = connection_->shared_from_this();
+    world_->add_client(this);
+}
+
+void client::disconnect_login(const std::string& reason)
+{
+    connection_->send(make_packet(packets::login::disconnect{R"({"text":")" + reason + R"("})"}), true);
+    connection_->shutdown();
+}
+
+void client::handle_keep_alive(const packets::play::keep_alive&)
+{
+}
+
+void client::handle_player_ground(const packets::play::player& packet)
+{
+    player_.on_ground = packet.on_ground;
+}
+
+void client::handle_player_position(const packets::play::player_position& packet)
+{
+    player_.x = packet.x;
+    player_.y = packet.y;
+    player_.z = packet.z;
+    player_.on_ground = packet.on_ground;
+    player_.moved = true;
+}
+
+void client::handle_player_look(const packets::play::player_look& packet)
+{
+    player_.yaw = packet.yaw;
+    player_.pitch = packet.pitch;
+    player_.on_ground = packet.on_ground;
+    player_.moved = true;
+}
+
+void client::handle_player_position_look(const packets::play::player_position_look& packet)
+{
+    player_.x = packet.x;
+    player_.y = packet.y;
+    player_.z = packet.z;
+    player_.yaw = packet.yaw;
+    player_.pitch = packet.pitch;
+    player_.on_ground = packet.on_ground;
+    player_.moved = true;
 }
@@ -20,33 +20,90 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <string>
 
 #include <boost/shared_ptr.hpp>
-#include <boost/thread/mutex.hpp>
 
-#include <protocol/byte_stream.hpp>
+#include <misc/spsc_ring.hpp>
+#include <protocol/byte_view.hpp>
+#include <protocol/packets.hpp>
+#include <world/chunk_stream.hpp>
+#include <world/entity.hpp>
 
 class connection;
+class world;
 
 class client
 {
 public:
-    explicit client(connection* con);
+    client(connection* con, world* w);
 
-    void add_packet(byte_stream& data);
+    void add_packet(const packet_view& data);
+
+    // Takes the next delayed packet off the queue, only the world tick may call this
+    bool next_packet(packet_view& packet);
+
+    // Called by the world tick, handles up to max queued delayed packets
+    // return -> number of packets handled
+    size_t handle_delayed_packets(size_t max);
+
+    // Called by the world tick when it removes the client. Returns the shared
+    // pointer that kept the connection alive, the connection and this client go
+    // away when the caller lets go of it.
+    boost::shared_ptr<connection> leave_world();
+
+    connection* get_connection()
+    {
+        return connection_;
+    }
+
+    // The entity of the player, only the world tick may touch this
+    entity& player()
+    {
+        return player_;
+    }
+
+    // The chunks the player has and is waiting for, only the world tick may touch
+    // this
+    chunk_stream& chunks()
+    {
+        return chunks_;
+    }
     
-    void unhandled_packet(byte_stream& data);
-    void handle_handshake(byte_stream& data);
+    // Packet handlers, see handlers.hpp
+    void unhandled_packet(byte_view& data);
+    void handle_handshake(const packets::handshaking::handshake& packet);
+
+    void handle_status_request(const packets::status::request& packet);
+    void handle_status_ping(const packets::status::ping& packet);
 
-    void handle_status_request(byte_stream& data);
-    void handle_status_ping(byte_stream& data);
+    void handle_login_start(const packets::login::start& packet);
+    void handle_encryption_response(const packets::login::encryption_response& packet);
 
-    void handle_login_start(byte_stream& data);
+    void handle_keep_alive(const packets::play::keep_alive& packet);
+    void handle_player_ground(const packets::play::player& packet);
+    void handle_player_position(const packets::play::player_position& packet);
+    void handle_player_look(const packets::play::player_look& packet);
+    void handle_player_position_look(const packets::play::player_position_look& packet);
 
 private:
     enum class state { fresh, status, login, world };
 
+    // Capacity of the delayed packet queue, a little over 12 seconds worth of
+    // movement packets.
+    static constexpr size_t max_delayed_packets = 256;
+    // Number of droppable packets in a row we drop before deciding the client is
+    // flooding us and disconnecting it.
+    static constexpr unsigned int max_dropped_packets = 64;
+
+    void queue_packet(const packet_view& packet, bool droppable);
+    // Sends the rest of the login and hands the client to the world
+    void finish_login(const std::string& uuid);
+    void disconnect_login(const std::string& reason);
+
     connection* connection_;
+    world* world_;
     // When the client_ goes into threaded mode (it is added to world and updates now
     // happen in world ticks) it gets a connection_->shared_from_this() pointer to make
     // sure the connection doesn't go away. When the client is removed from the world this
@@ -55,10 +112,19 @@ private:
     boost::shared_ptr<connection> shared_connection_;
     
     state state_;
+    std::string username_;
+    // Sent in the encryption request, empty until then
+    std::vector<uint8_t> verify_token_;
     
-    // mutex_ protects the packets_ queue
-    boost::mutex mutex_;
-    std::vector<byte_stream> packets_;
+    // Delayed packets on their way from the io thread to the world tick. The queued
+    // views keep their part of the receive slab alive until the world tick is done
+    // with them. The queue is only created once the client logs in, status pings
+    // never need it.
+    std::unique_ptr<spsc_ring<packet_view>> packets_;
+    unsigned int dropped_;
+
+    entity player_;
+    chunk_stream chunks_;
 };
 
 #endif
@@ -23,172 +23,397 @@
 using namespace boost::asio;
 using namespace boost::posix_time;
 
-connection::connection(io_service& io, void*) :
-    io_(io), socket_(io), client_(this), sending_(false), shutdown_{false},
-    flush_timer_{io_}
+constexpr std::chrono::seconds connection::handshake_timeout;
+constexpr std::chrono::seconds connection::login_timeout;
+std::atomic<uint64_t> connection::deadlines_missed_{0};
+
+connection::connection(io_service& io, world* w) :
+    io_(io), socket_(io), reader_{receive_buffer_size, buffer_limit},
+    compression_threshold_{-1}, compression_level_{0}, decrypt_buffered_{false}, client_(this, w),
+    state_{0}, queued_bytes_{0}, writing_bytes_{0}, cork_{false}, flush_threshold_{0}, max_delay_us_{-1},
+    cork_pending_{false}, timer_pending_{false}, flush_timer_{io_}, deadline_{io_},
+    writes_{0}, packets_written_{0}, bytes_written_{0}, max_packets_written_{0},
+    capture_{nullptr}, capture_id_{0}
 {
+    set_flush_policy(flush_policy::corked());
+}
 
+connection::~connection()
+{
+    if (capture_)
+        capture_->record(capture_id_, capture_event::close, 0);
 }
 
+// The receive slab is only allocated once the first bytes arrive, a connection
+// that is opened and left idle costs no more than the connection object until
+// its deadline passes.
 void connection::start()
 {
-    socket_.set_option(boost::asio::ip::tcp::no_delay(true));
-    remote_addr_ = socket_.remote_endpoint().address().to_string();
-    
-    read_header();
+    boost::system::error_code err;
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true), err);
+    remote_addr_ = socket_.remote_endpoint(err).address().to_string();
+    if (err)
+    {
+        LOG_DEBUG(log::dbg::connection, "connection closed before it started", err);
+        stop();
+        return;
+    }
+
+    capture_ = packet_capture::installed();
+    if (capture_)
+    {
+        capture_id_ = capture_->next_connection();
+        capture_->record(capture_id_, capture_event::open, 0);
+    }
+
+    set_deadline(handshake_timeout);
+    socket_.async_wait(ip::tcp::socket::wait_read,
+        boost::bind(&connection::handle_readable, shared_from_this(), placeholders::error));
 }
 
 void connection::shutdown()
 {
-    DE(log::debug(log::dbg::connection, remote_addr_, "soft connection shutdown"));
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    shutdown_ = true;
-    if (sending_ == false && send_queue_.size() == 0)
-        stop();
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "soft connection shutdown");
+    state_.fetch_or(shut_down, std::memory_order_acq_rel);
+    // Don't leave the packets that are still corked behind, the connection is
+    // stopped once the queue is drained.
+    request_flush();
 }
     
-void connection::read_header()
+void connection::set_deadline(std::chrono::seconds timeout)
 {
-    len_idx_ = 0;
-    buffer_.resize(1);
-    async_read(socket_, buffer(const_cast<std::vector<uint8_t>&>(buffer_.data())),
-        boost::bind(&connection::handle_read_header, shared_from_this(),
-        placeholders::error, placeholders::bytes_transferred));
+    deadline_.expires_after(timeout);
+    deadline_.async_wait(boost::bind(&connection::handle_deadline, shared_from_this(), placeholders::error));
 }
 
-void connection::send(std::shared_ptr<byte_stream>& data, bool force_flush /* = false */)
+void connection::clear_deadline()
 {
-    DE(log::debug(log::dbg::connection, remote_addr_, "adding packet of", data->size(), "bytes to send queue"));
-    DE(log::debug(log::dbg::packet, remote_addr_, "sending packet", data->hexdump()));
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    if (shutdown_)
-        return;
+    deadline_.cancel();
+}
 
-    send_queue_.push_back(data);
-    if (sending_)
+void connection::handle_deadline(const boost::system::error_code& e)
+{
+    if (e || closed())
         return;
-    
-    if (force_flush)
-    {
-        flush_queue();
-    }
-    else if (send_queue_.size() == 1)
-    {
-        // If we aren't already sending, and this is the first packet we queue we
-        // start the flush_timer_
-        flush_timer_.expires_from_now(milliseconds{10});
-        flush_timer_.async_wait(boost::bind(&connection::handle_flush_timeout, shared_from_this()));
-    }
+
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "missed its deadline");
+    deadlines_missed_.fetch_add(1, std::memory_order_relaxed);
+    stop();
 }
 
-// Read byte by byte until we have a complete header size (VarInt for sizes in
-// your protocol seems kind of stupid to me but whatever)
-void connection::handle_read_header(const boost::system::error_code& e, std::size_t)
+void connection::handle_readable(const boost::system::error_code& e)
 {
     if (e)
     {
-        DE(log::debug(log::dbg::connection, remote_addr_, "handle_read_header", e));
+        LOG_DEBUG(log::dbg::connection, remote_addr_, "handle_readable", e);
         stop();
         return;
     }
-    
-    if (len_.append_byte(buffer_.data()[0], len_idx_++))
-    {
-        async_read(socket_, buffer(const_cast<std::vector<uint8_t>&>(buffer_.data())),
-            boost::bind(&connection::handle_read_header, shared_from_this(),
-            placeholders::error, placeholders::bytes_transferred));
-    }
+
+    read();
+}
+
+void connection::read()
+{
+    socket_.async_read_some(reader_.prepare(),
+        boost::bind(&connection::handle_read, shared_from_this(),
+        placeholders::error, placeholders::bytes_transferred));
+}
+
+void connection::send(const packet_ptr& data, bool force_flush /* = false */)
+{
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "adding packet of", data->size(), "bytes to send queue");
+    LOG_DEBUG(log::dbg::packet, remote_addr_, "sending packet", data->hexdump());
+    if (state_.load(std::memory_order_acquire) & shut_down)
+        return;
+
+    int compression = compression_threshold_.load(std::memory_order_acquire);
+    if (compression >= 0)
+        data->frame_compressed(compression, compression_level_.load(std::memory_order_relaxed));
     else
+        data->frame();
+    size_t size = data->wire_size();
+    if (capture_)
+        capture_frame(*data);
+    send_queue_.push(data);
+    size_t queued = queued_bytes_.fetch_add(size, std::memory_order_relaxed) + size;
+
+    size_t threshold = flush_threshold_.load(std::memory_order_relaxed);
+    if (force_flush || (threshold && queued >= threshold))
+        request_flush();
+    // flush_queue picks the packet up when the current write is done
+    else if (!(state_.load(std::memory_order_acquire) & sending))
+        schedule_flush();
+}
+
+void connection::enable_compression(const compression_config& config)
+{
+    compression_level_.store(config.level, std::memory_order_relaxed);
+    compression_threshold_.store(config.threshold, std::memory_order_release);
+}
+
+void connection::enable_encryption(const std::vector<uint8_t>& secret)
+{
+    if (secret.size() != cfb8::key_size)
+        throw std::runtime_error("shared secret has the wrong size.");
+    encryptor_.reset(new cfb8{secret.data(), cfb8::mode::encrypt});
+    decryptor_.reset(new cfb8{secret.data(), cfb8::mode::decrypt});
+    decrypt_buffered_ = true;
+}
+
+void connection::flush()
+{
+    if (queued_bytes_.load(std::memory_order_relaxed))
+        request_flush();
+}
+
+void connection::set_flush_policy(const flush_policy& policy)
+{
+    cork_.store(policy.cork, std::memory_order_relaxed);
+    flush_threshold_.store(policy.byte_threshold, std::memory_order_relaxed);
+    max_delay_us_.store(policy.max_delay.is_special() ? -1 : policy.max_delay.total_microseconds(),
+        std::memory_order_relaxed);
+}
+
+send_stats connection::stats()
+{
+    return send_stats{
+        writes_.load(std::memory_order_relaxed),
+        packets_written_.load(std::memory_order_relaxed),
+        bytes_written_.load(std::memory_order_relaxed),
+        max_packets_written_.load(std::memory_order_relaxed)};
+}
+
+// Arms the triggers of the flush policy for a queue that isn't being written.
+// Only one cork handler and one timer are pending at a time, later packets ride
+// along with them.
+void connection::schedule_flush()
+{
+    // A handler posted from the io thread runs after the handler that is running
+    // now, so that's where the cork comes off. We have no way of knowing when
+    // another thread is done, those call flush() themselves.
+    if (cork_.load(std::memory_order_relaxed) && io_.get_executor().running_in_this_thread())
     {
-        if (len_ > buffer_limit)
+        if (!cork_pending_)
         {
-            log::error(remote_addr_, "tried to send a packet of", len_, "bytes, max allowed is", buffer_limit);
-            stop();
-            return;
+            cork_pending_ = true;
+            io_.post(boost::bind(&connection::handle_cork, shared_from_this()));
         }
-        buffer_.resize(len_);
-        
-        async_read(socket_, buffer(const_cast<std::vector<uint8_t>&>(buffer_.data())),
-            boost::bind(&connection::handle_read_body, shared_from_this(),
-            placeholders::error, placeholders::bytes_transferred));
     }
+
+    if (max_delay_us_.load(std::memory_order_relaxed) >= 0 && !timer_pending_.exchange(true))
+        io_.dispatch(boost::bind(&connection::arm_flush_timer, shared_from_this()));
 }
 
-void connection::handle_read_body(const boost::system::error_code& e, std::size_t)
+// Takes ownership of the sending state if nobody has it and lets the io thread
+// write the queue. If somebody else has it the queue is written after the
+// current write anyway.
+void connection::request_flush()
+{
+    if ((state_.fetch_or(sending, std::memory_order_acq_rel) & sending) == 0)
+        io_.dispatch(boost::bind(&connection::flush_queue, shared_from_this()));
+}
+
+// Read whatever the socket has available and hand every complete packet in the
+// receive buffer to the client before starting the next read. This way a burst of
+// small packets costs a single read instead of a couple of reads per packet.
+void connection::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
 {
     if (e)
     {
-        DE(log::debug(log::dbg::connection, remote_addr_, "handle_read_body", e));
+        LOG_DEBUG(log::dbg::connection, remote_addr_, "handle_read", e);
+        stop();
+        return;
+    }
+
+    size_t decrypted = reader_.buffered();
+    reader_.commit(bytes_transferred);
+    if (decryptor_)
+        decryptor_->apply(reader_.buffered_data() + decrypted, reader_.buffered_data() + decrypted, bytes_transferred);
+
+    packet_view frame;
+    try
+    {
+        while (reader_.next(frame))
+        {
+            bool compressed = compression_threshold_.load(std::memory_order_relaxed) >= 0;
+            if (capture_)
+                capture_->record(capture_id_, capture_event::inbound, compressed ? capture_compressed : 0,
+                    frame.data(), frame.size());
+            if (compressed)
+                frame = decompress(frame);
+            LOG_DEBUG(log::dbg::packet, remote_addr_, "received packet", frame.hexdump());
+            client_.add_packet(frame);
+
+            // Whatever came in behind the encryption response is encrypted already
+            if (decrypt_buffered_)
+            {
+                decrypt_buffered_ = false;
+                decryptor_->apply(reader_.buffered_data(), reader_.buffered_data(), reader_.buffered());
+            }
+        }
+    }
+    catch (std::exception& ex)
+    {
+        LOG_ERROR(remote_addr_, "invalid frame:", ex.what());
         stop();
         return;
     }
 
-    buffer_.pos(0);
-    DE(log::debug(log::dbg::packet, remote_addr_, "received packet", buffer_.hexdump()));
-    client_.add_packet(buffer_);
+    read();
+}
+
+// With compression a frame starts with the length of the uncompressed packet, 0
+// if the packet isn't compressed. Compressed packets get a slab of their own, the
+// length is checked against buffer_limit before anything is allocated.
+packet_view connection::decompress(const packet_view& frame)
+{
+    packet_view view{frame};
+    varint<size_t> size;
+    view >> size;
+
+    const uint8_t* data = view.data() + view.pos();
+    size_t compressed_size = view.size() - view.pos();
+    if (size == 0)
+        return packet_view{frame, data, compressed_size};
+
+    if (size > buffer_limit)
+        throw std::runtime_error("compressed packet is larger than allowed.");
+    if (size < static_cast<size_t>(compression_threshold_.load(std::memory_order_relaxed)))
+        throw std::runtime_error("compressed packet is below the compression threshold.");
+
+    slab_ptr s = slab::create(size);
+    ::decompress(data, compressed_size, s->data(), size);
+    return packet_view{s, s->data(), size};
+}
 
-    read_header();
+// Records a framed outbound packet, the header without the length prefix
+void connection::capture_frame(packet_buffer& packet)
+{
+    uint64_t length;
+    size_t prefix = varint_codec::decode(packet.header(), packet.header_size(), frame_reader::max_header_size, length);
+    capture_->record(capture_id_, capture_event::outbound, packet.compressed_format() ? capture_compressed : 0,
+        packet.header() + prefix, packet.header_size() - prefix, packet.body(), packet.body_size());
 }
 
-void connection::handle_write(const boost::system::error_code& e, std::size_t)
+void connection::handle_write(const boost::system::error_code& e, std::size_t bytes_transferred)
 {
     if (e)
     {
-        DE(log::debug(log::dbg::connection, remote_addr_, "handle_write", e));
+        LOG_DEBUG(log::dbg::connection, remote_addr_, "handle_write", e);
         stop();
         return;
     }
     
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    if (send_queue_.size())
-    {
-        flush_queue();
-    }
-    else
-    {
-        sending_ =  false;
-        if (shutdown_)
-            stop();
-    }
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "wrote", send_buffer_.size(), "packets in", bytes_transferred, "bytes");
+    writes_.fetch_add(1, std::memory_order_relaxed);
+    packets_written_.fetch_add(send_buffer_.size(), std::memory_order_relaxed);
+    bytes_written_.fetch_add(bytes_transferred, std::memory_order_relaxed);
+    if (send_buffer_.size() > max_packets_written_.load(std::memory_order_relaxed))
+        max_packets_written_.store(send_buffer_.size(), std::memory_order_relaxed);
+    send_buffer_.clear();
+    writing_bytes_.store(0, std::memory_order_relaxed);
+
+    flush_queue();
 }
 
-void connection::handle_flush_timeout()
+void connection::handle_cork()
 {
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    flush_queue();
+    cork_pending_ = false;
+    request_flush();
 }
 
-// This function dequeues a packet, sets the sending_ value and starts sending
-// the header of the packet.
-// To call this:
-//   You MUST have ownership of mutex_
-//   You MUST NOT call this if sending_ is true already
-//   You MUST make sure send_queue_ is NOT empty
+void connection::arm_flush_timer()
+{
+    flush_timer_.expires_from_now(microseconds{max_delay_us_.load(std::memory_order_relaxed)});
+    flush_timer_.async_wait(boost::bind(&connection::handle_flush_timeout,
+        shared_from_this(), placeholders::error));
+}
+
+void connection::handle_flush_timeout(const boost::system::error_code& e)
+{
+    timer_pending_ = false;
+    if (!e)
+        request_flush();
+}
+
+// This function dequeues all packets and starts writing them. The packets are
+// framed already, so we only gather their buffers. If the queue is empty it gives
+// up the sending state, or stops the connection if it's shutting down.
 void connection::flush_queue()
 {
-    DE(log::debug(log::dbg::connection, remote_addr_, "flushing send queue with", send_queue_.size(), "packets"));
-    sending_ = true;
-    send_buffer_.clear();
-    header_buffer_.clear();
-    std::swap(send_queue_, send_buffer_);
+    for (;;)
+    {
+        packet_ptr packet;
+        size_t bytes = 0;
+        while (send_queue_.pop(packet))
+        {
+            bytes += packet->wire_size();
+            send_buffer_.push_back(std::move(packet));
+        }
+
+        if (send_buffer_.size())
+        {
+            writing_bytes_.store(bytes, std::memory_order_relaxed);
+            queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            break;
+        }
+
+        if (state_.fetch_and(~sending, std::memory_order_acq_rel) & shut_down)
+        {
+            stop();
+            return;
+        }
+
+        // Catch packets that were pushed while we still owned the sending state
+        if (send_queue_.empty() || (state_.fetch_or(sending, std::memory_order_acq_rel) & sending))
+            return;
+    }
+
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "flushing send queue with", send_buffer_.size(), "packets");
+    if (encryptor_)
+    {
+        write_encrypted();
+        return;
+    }
+
     std::vector<const_buffer> scatter_buffer;
+    scatter_buffer.reserve(send_buffer_.size() * 2);
     for (auto& buf : send_buffer_)
     {
-        size_t size_start = header_buffer_.size();
-        varint<size_t>::bytes(buf->size(), header_buffer_);
-        size_t size = header_buffer_.size() - size_start;
-
-        scatter_buffer.emplace_back(&header_buffer_[size_start], size);
-        scatter_buffer.emplace_back(&buf->data()[0], buf->size());
+        scatter_buffer.emplace_back(buf->header(), buf->header_size());
+        scatter_buffer.emplace_back(buf->body(), buf->body_size());
     }
     
-    socket_.async_send(scatter_buffer, boost::bind(&connection::handle_write,
+    // async_write instead of a single async_send, the socket may take only part
+    // of a large batch
+    async_write(socket_, scatter_buffer, boost::bind(&connection::handle_write,
+        shared_from_this(), placeholders::error, placeholders::bytes_transferred));
+}
+
+// Gathers the packets into encrypted_ and encrypts them on the way, one pass over
+// every byte. The buffer keeps its capacity for the next flush.
+void connection::write_encrypted()
+{
+    encrypted_.clear();
+    for (auto& buf : send_buffer_)
+    {
+        size_t pos = encrypted_.size();
+        encrypted_.resize(pos + buf->wire_size());
+        encryptor_->apply(buf->header(), encrypted_.data() + pos, buf->header_size());
+        encryptor_->apply(buf->body(), encrypted_.data() + pos + buf->header_size(), buf->body_size());
+    }
+
+    async_write(socket_, buffer(encrypted_), boost::bind(&connection::handle_write,
         shared_from_this(), placeholders::error, placeholders::bytes_transferred));
 }
 
 void connection::stop()
 {
-    DE(log::debug(log::dbg::connection, remote_addr_, "hard connection stop"));
+    LOG_DEBUG(log::dbg::connection, remote_addr_, "hard connection stop");
+    state_.fetch_or(shut_down, std::memory_order_acq_rel);
+    // The pending deadline would keep the connection alive until it passes
+    deadline_.cancel();
     boost::system::error_code err;
     if (socket_.is_open())
         socket_.shutdown(ip::tcp::socket::shutdown_both, err);
@@ -19,16 +19,28 @@
 #define BARIUMSULFATE__CONNECTION__CONNECTION_HPP
 
 #include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 
 #include <connection/client.hpp>
-#include <protocol/byte_stream.hpp>
+#include <connection/flush_policy.hpp>
+#include <connection/frame_reader.hpp>
+#include <connection/packet_capture.hpp>
+#include <misc/mpsc_queue.hpp>
+#include <protocol/cfb8.hpp>
+#include <protocol/compression.hpp>
+#include <protocol/packet_pool.hpp>
 #include <protocol/varint.hpp>
 
+class world;
+
 /* 
  Lifetime of this object:
  ------------------------
@@ -51,11 +63,74 @@ class connection :
     private boost::noncopyable
 {
 public:
-    explicit connection(boost::asio::io_service& io, void*);
+    // A connection has handshake_timeout from the moment it is accepted to get
+    // through the handshake, or through the whole server list ping, and
+    // login_timeout from the handshake on to get into the world. Connections
+    // that don't make it are stopped.
+    static constexpr std::chrono::seconds handshake_timeout{5};
+    static constexpr std::chrono::seconds login_timeout{30};
+
+    connection(boost::asio::io_service& io, world* w);
+    ~connection();
     void start();
     void shutdown();
 
-    void send(std::shared_ptr<byte_stream>& data, bool force_flush = false);
+    // true once the connection is shut down or stopped, nothing will be sent anymore
+    bool closed() const
+    {
+        return (state_.load(std::memory_order_acquire) & shut_down) != 0;
+    }
+
+    // Queues a packet for sending. The packet is framed if that didn't happen yet,
+    // after which it must not be modified anymore. A framed packet can be queued on
+    // several connections, see broadcast.hpp. When the packet is written depends on
+    // the flush_policy of the connection, unless force_flush is set.
+    void send(const packet_ptr& data, bool force_flush = false);
+
+    // Switches both directions to the compressed format, packets sent from here on
+    // are framed for compression. Call this on the io thread right after sending
+    // the set compression packet.
+    void enable_compression(const compression_config& config);
+
+    // true once enable_compression was called, packets sent to this connection have
+    // to be framed with compression
+    bool compressed() const
+    {
+        return compression_threshold_.load(std::memory_order_acquire) >= 0;
+    }
+
+    // Encrypts both directions with AES/CFB8 from here on, the shared secret is
+    // the key. Call this on the io thread while handling the encryption response,
+    // bytes already received after it are decrypted before the next frame is
+    // read. Packets still in the send queue go out encrypted.
+    void enable_encryption(const std::vector<uint8_t>& secret);
+
+    // Writes the queued packets as soon as possible, a write that is in progress
+    // takes them along when it's done. Threads other than the io thread of the
+    // connection call this when they are done sending to a corked connection.
+    // Does nothing if there's nothing queued.
+    void flush();
+
+    // Bytes sent to the connection that the socket didn't take yet, both queued
+    // and in the write that is in progress. Thread safe, but only a snapshot.
+    size_t pending_bytes() const
+    {
+        return queued_bytes_.load(std::memory_order_relaxed) + writing_bytes_.load(std::memory_order_relaxed);
+    }
+
+    // Stops the connection when timeout passes before clear_deadline is called,
+    // replacing the previous deadline. Only call these from the io thread.
+    void set_deadline(std::chrono::seconds timeout);
+    void clear_deadline();
+
+    // Number of connections that were stopped because they missed a deadline
+    static uint64_t deadlines_missed()
+    {
+        return deadlines_missed_.load(std::memory_order_relaxed);
+    }
+
+    void set_flush_policy(const flush_policy& policy);
+    send_stats stats();
     
     boost::asio::ip::tcp::socket& socket()
     {
@@ -71,41 +146,98 @@ private:
     // Maximum packet size we are willing to accept
     static constexpr size_t buffer_limit = 8192;
     static constexpr size_t buffer_initial_size = 512;
-    static constexpr size_t header_buffer_size = 4;
+    // Size of the receive buffer, this allows a single read to pick up a couple of
+    // maximum sized packets or hundreds of small ones.
+    static constexpr size_t receive_buffer_size = 4 * buffer_limit;
 
-    void read_header();
+    void read();
+    void handle_readable(const boost::system::error_code& e);
+    void handle_deadline(const boost::system::error_code& e);
+    // Turns a frame received with compression on into the packet it carries
+    packet_view decompress(const packet_view& frame);
 
-    void handle_read_header(const boost::system::error_code& e, std::size_t bytes_transferred);
-    void handle_read_body(const boost::system::error_code& e, std::size_t bytes_transferred);
+    void handle_read(const boost::system::error_code& e, std::size_t bytes_transferred);
     void handle_write(const boost::system::error_code& e, std::size_t bytes_transferred);
 
-    void handle_flush_timeout();
-    void flush_queue(); // You MAY NOT call this function unless you have ownership of mutex_
+    void handle_cork();
+    void arm_flush_timer();
+    void handle_flush_timeout(const boost::system::error_code& e);
+    void schedule_flush();
+    void request_flush();
+
+    void capture_frame(packet_buffer& packet);
+
+    // Only call these from the io thread while owning the sending state
+    void flush_queue();
+    void write_encrypted();
 
     void stop();
 
     boost::asio::io_service& io_;
     boost::asio::ip::tcp::socket socket_;
     
-    varint<size_t> len_;
-    int len_idx_;
-    byte_stream buffer_;
+    frame_reader reader_;
+
+    // The compression settings of both directions, a threshold of -1 until
+    // compression is enabled
+    std::atomic<int> compression_threshold_;
+    std::atomic<int> compression_level_;
+
+    // Inbound bytes are decrypted in place in the receive slab. Outbound packets
+    // can be shared with other connections (see broadcast.hpp), so they are
+    // encrypted into encrypted_ instead, which is only touched by flush_queue.
+    std::unique_ptr<cfb8> encryptor_;
+    std::unique_ptr<cfb8> decryptor_;
+    bool decrypt_buffered_;
+    std::vector<uint8_t> encrypted_;
 
     client client_;
     
-    // The mutex protects sending_, shutdown_ and send_queue_
-    // While sending_ is true send_buffer_ and header_buffer_ should not be
-    // altered in any way.
-    boost::mutex mutex_;
-    std::vector<std::shared_ptr<byte_stream>> send_queue_;
-    std::vector<std::shared_ptr<byte_stream>> send_buffer_;
-    std::vector<uint8_t> header_buffer_;
-    bool sending_;
-    bool shutdown_;
+    // Send state machine
+    // -------------------
+    // Any thread may push to send_queue_. Writing is owned by whoever sets the
+    // sending bit in state_: a producer that wants the queue flushed tries to set
+    // it and, if it succeeds, has the io thread run flush_queue. The io thread
+    // keeps the bit while writes are in flight and clears it once the queue is
+    // drained, after which it checks the queue once more to catch packets pushed
+    // in the meantime. This way producers never block and only the io thread
+    // touches send_buffer_ and the socket.
+    //
+    // While the sending bit is set send_buffer_ should not be altered in any way.
+    // The packets in send_buffer_ go back to the packet_pool as soon as they are
+    // written.
+    enum state_bits : uint32_t {sending = 1, shut_down = 2};
+
+    std::atomic<uint32_t> state_;
+    mpsc_queue<packet_ptr> send_queue_;
+    std::atomic<size_t> queued_bytes_;
+    std::atomic<size_t> writing_bytes_;
+    std::vector<packet_ptr> send_buffer_;
+
+    // The flush policy, it can be changed while other threads are sending
+    std::atomic<bool> cork_;
+    std::atomic<size_t> flush_threshold_;
+    std::atomic<int64_t> max_delay_us_;  // negative if disabled
+
+    // cork_pending_ and flush_timer_ are only touched on the io thread
+    bool cork_pending_;
+    std::atomic<bool> timer_pending_;
+    boost::asio::deadline_timer flush_timer_;
+
+    boost::asio::steady_timer deadline_;
+    static std::atomic<uint64_t> deadlines_missed_;
+
+    std::atomic<uint64_t> writes_;
+    std::atomic<uint64_t> packets_written_;
+    std::atomic<uint64_t> bytes_written_;
+    std::atomic<uint64_t> max_packets_written_;
 
     std::string remote_addr_;
 
-    boost::asio::deadline_timer flush_timer_;
+    // The capture this connection records its frames to, if one was installed
+    // when it started
+    packet_capture* capture_;
+    uint32_t capture_id_;
 };
 
 #endif
@@ -0,0 +1,67 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__CONNECTION__FLUSH_POLICY_HPP
+#define BARIUMSULFATE__CONNECTION__FLUSH_POLICY_HPP
+
+#include <cstdint>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Decides when the packets queued on a connection are written to the socket. The
+// triggers combine, the queue is flushed by whichever fires first. A forced send
+// (connection::send with force_flush) always flushes right away.
+struct flush_policy
+{
+    // Cork the connection: packets sent from its io thread are written once the
+    // current io handler is done, so everything sent while handling one read goes
+    // out in a single write. Other threads (world ticks) have to call
+    // connection::flush when they are done sending.
+    bool cork;
+
+    // Flush as soon as this many bytes are queued, 0 disables the threshold.
+    size_t byte_threshold;
+
+    // Longest time a packet may wait in the queue, not_a_date_time disables the
+    // timer. Only useful as a safety net for corked connections that are sent to
+    // from other threads, or as the only trigger for bulk transfers.
+    boost::posix_time::time_duration max_delay;
+
+    // Default for every connection, lowest latency without a write per packet
+    static flush_policy corked()
+    {
+        return flush_policy{true, 16 * 1024, boost::posix_time::not_a_date_time};
+    }
+
+    // Collects packets for a while before writing them, for connections where
+    // latency doesn't matter and fewer, larger writes do
+    static flush_policy delayed(boost::posix_time::time_duration delay, size_t threshold = 64 * 1024)
+    {
+        return flush_policy{false, threshold, delay};
+    }
+};
+
+// What the writes on a connection actually carried
+struct send_stats
+{
+    uint64_t writes;        // completed writes
+    uint64_t packets;       // packets written
+    uint64_t bytes;         // bytes written, including length prefixes
+    uint64_t max_packets;   // most packets carried by a single write
+};
+
+#endif
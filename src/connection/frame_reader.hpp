@@ -0,0 +1,155 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__CONNECTION__FRAME_READER_HPP
+#define BARIUMSULFATE__CONNECTION__FRAME_READER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <protocol/byte_view.hpp>
+#include <protocol/slab.hpp>
+#include <protocol/varint.hpp>
+
+// Splits the raw byte stream of a connection into length prefixed frames.
+//
+// The connection reads as much as the socket has available into the free space
+// at the end of the current slab (prepare/commit) and then pulls every complete
+// frame out of it with next(). Frames are handed out as packet_views into the
+// slab, so no packet is copied on its way to the handlers.
+//
+// A frame that is only partially received stays where it is until the slab
+// doesn't have room left to complete a maximum sized frame. At that point it is
+// moved to the front of the slab, or, if packet_views still reference the slab,
+// to a fresh slab so the old one can live on until those packets are handled.
+//
+// The first slab is allocated by the first prepare(), so a connection that never
+// reads doesn't hold one.
+class frame_reader : private boost::noncopyable
+{
+public:
+    // Longest VarInt we accept as a frame length
+    static constexpr size_t max_header_size = 5;
+
+    // capacity -> size of the receive slabs
+    // limit    -> largest frame body we accept, capacity must be at least
+    //             limit + max_header_size
+    frame_reader(size_t capacity, size_t limit) :
+        begin_{0}, end_{0}, capacity_{capacity}, limit_{limit}
+    {
+        if (capacity < limit + max_header_size)
+            throw std::logic_error("frame_reader capacity can't hold a maximum sized frame.");
+    }
+
+    // Returns the free space after the buffered data.
+    boost::asio::mutable_buffers_1 prepare()
+    {
+        if (!slab_)
+            slab_ = slab::create(capacity_);
+        else if (begin_ == end_ && slab_->unique())
+            begin_ = end_ = 0;
+        else if (slab_->capacity() - begin_ < limit_ + max_header_size)
+            compact();
+
+        return boost::asio::buffer(slab_->data() + end_, slab_->capacity() - end_);
+    }
+
+    // Marks n bytes of the space returned by prepare() as received
+    void commit(size_t n)
+    {
+        end_ += n;
+    }
+
+    // Extracts the next complete frame from the buffer. The view keeps the slab
+    // alive, but the data is only guaranteed to stay untouched as long as the
+    // view (or a copy of it) exists.
+    //
+    // frame  -> set to the frame body
+    // return -> true if a frame was extracted, false if we need more data
+    bool next(packet_view& frame)
+    {
+        size_t available = end_ - begin_;
+        if (!available)
+            return false;
+
+        const uint8_t* data = slab_->data() + begin_;
+        uint64_t size = 0;
+        size_t header = varint_codec::decode(data, available, max_header_size, size);
+        if (!header)
+            return false;
+
+        if (size == 0)
+            throw std::runtime_error("received an empty frame.");
+        if (size > limit_)
+            throw std::runtime_error("received a frame that is larger than allowed.");
+        if (header + size > available)
+            return false;
+
+        frame = packet_view{slab_, data + header, size};
+        begin_ += header + size;
+        return true;
+    }
+
+    // Number of received bytes that are not part of an extracted frame yet
+    size_t buffered() const
+    {
+        return end_ - begin_;
+    }
+
+    // The buffered bytes, writable so a stream cipher can work on them in place
+    uint8_t* buffered_data()
+    {
+        return slab_->data() + begin_;
+    }
+
+private:
+    // Moves the unprocessed data to the front of a slab nobody else references.
+    // The previous slab is kept as a spare when we have to switch, once the packets
+    // in it are gone we can switch back to it without allocating.
+    void compact()
+    {
+        size_t len = end_ - begin_;
+
+        if (slab_->unique())
+        {
+            std::memmove(slab_->data(), slab_->data() + begin_, len);
+        }
+        else
+        {
+            if (!spare_ || !spare_->unique())
+                spare_ = slab::create(capacity_);
+            std::memcpy(spare_->data(), slab_->data() + begin_, len);
+            std::swap(slab_, spare_);
+        }
+
+        begin_ = 0;
+        end_ = len;
+    }
+
+    size_t begin_;
+    size_t end_;
+    size_t capacity_;
+    size_t limit_;
+    slab_ptr slab_;
+    slab_ptr spare_;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <connection/packet_capture.hpp>
+#include <misc/log.hpp>
+#include <protocol/compression.hpp>
+#include <protocol/endian.hpp>
+#include <protocol/varint.hpp>
+
+namespace
+{
+
+const char magic[8] = {'B', 'S', 'C', 'A', 'P', 'T', 'R', '1'};
+constexpr size_t header_size = 8 + 4 + 1 + 1 + 4;
+
+// Larger frames than the server ever sends or accepts mean the file is broken
+constexpr size_t max_record_size = 64 << 20;
+
+}
+
+std::atomic<packet_capture*> packet_capture::installed_{nullptr};
+
+packet_capture::packet_capture(const std::string& path) :
+    start_{std::chrono::steady_clock::now()}, next_connection_{1}, records_{0}, dropped_{0},
+    file_{std::fopen(path.c_str(), "wb")}, buffered_records_{0}, failed_{false}
+{
+    if (!file_)
+        throw std::runtime_error("failed to open the capture file " + path + ".");
+
+    buffer_.reserve(buffer_size);
+    uint8_t header[16];
+    std::memcpy(header, magic, sizeof(magic));
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    endian::store_le(header + 8, now);
+    buffer_.insert(buffer_.end(), header, header + sizeof(header));
+}
+
+packet_capture::~packet_capture()
+{
+    flush();
+    std::fclose(file_);
+}
+
+void packet_capture::record(uint32_t connection, capture_event event, uint8_t flags,
+    const uint8_t* data, size_t size, const uint8_t* more, size_t more_size)
+{
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+
+    uint8_t header[header_size];
+    endian::store_le(header, time);
+    endian::store_le(header + 8, connection);
+    header[12] = static_cast<uint8_t>(event);
+    header[13] = flags;
+    endian::store_le(header + 14, static_cast<uint32_t>(size + more_size));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!failed_ && buffer_.size() + header_size + size + more_size > buffer_size)
+        write_buffer();
+    if (failed_)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer_.insert(buffer_.end(), header, header + header_size);
+    buffer_.insert(buffer_.end(), data, data + size);
+    buffer_.insert(buffer_.end(), more, more + more_size);
+    buffered_records_++;
+    records_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void packet_capture::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_)
+        return;
+    write_buffer();
+    if (!failed_ && std::fflush(file_) != 0)
+        fail();
+}
+
+// Only call these while holding mutex_
+void packet_capture::write_buffer()
+{
+    if (!buffer_.empty() && std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+        return fail();
+    buffer_.clear();
+    buffered_records_ = 0;
+}
+
+// Records are called from every thread that sends, and from destructors, so
+// a failed write turns the capture off instead of throwing
+void packet_capture::fail()
+{
+    LOG_ERROR("Writing to the capture file failed:", std::strerror(errno), "- capturing stopped,",
+        buffered_records_, "buffered records dropped");
+    failed_ = true;
+    records_.fetch_sub(buffered_records_, std::memory_order_relaxed);
+    dropped_.fetch_add(buffered_records_, std::memory_order_relaxed);
+    buffered_records_ = 0;
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+}
+
+std::vector<uint8_t> capture_record::packet() const
+{
+    if (!(flags & capture_compressed))
+        return data;
+
+    uint64_t size = 0;
+    size_t header = varint_codec::decode(data.data(), data.size(), varint_codec::max_size<uint32_t>(), size);
+    if (!header)
+        throw std::runtime_error("capture record is too short for a compressed frame.");
+    if (size == 0)
+        return std::vector<uint8_t>(data.begin() + header, data.end());
+    if (size > max_record_size)
+        throw std::runtime_error("capture record decompresses to more than allowed.");
+
+    std::vector<uint8_t> packet(size);
+    decompress(data.data() + header, data.size() - header, packet.data(), packet.size());
+    return packet;
+}
+
+capture_reader::capture_reader(const std::string& path) : file_{std::fopen(path.c_str(), "rb")}
+{
+    if (!file_)
+        throw std::runtime_error("failed to open the capture file " + path + ".");
+
+    uint8_t header[16];
+    if (std::fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+        std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        std::fclose(file_);
+        throw std::runtime_error(path + " is not a capture file.");
+    }
+    start_time_ = endian::load_le<uint64_t>(header + 8);
+}
+
+capture_reader::~capture_reader()
+{
+    std::fclose(file_);
+}
+
+bool capture_reader::next(capture_record& record)
+{
+    uint8_t header[header_size];
+    size_t n = std::fread(header, 1, header_size, file_);
+    if (n == 0)
+        return false;
+    if (n != header_size)
+        throw std::runtime_error("capture file ends in the middle of a record.");
+
+    record.time = endian::load_le<uint64_t>(header);
+    record.connection = endian::load_le<uint32_t>(header + 8);
+    record.event = static_cast<capture_event>(header[12]);
+    record.flags = header[13];
+    uint32_t size = endian::load_le<uint32_t>(header + 14);
+    if (size > max_record_size)
+        throw std::runtime_error("capture record is larger than allowed.");
+
+    record.data.resize(size);
+    if (std::fread(record.data.data(), 1, size, file_) != size)
+        throw std::runtime_error("capture file ends in the middle of a record.");
+    return true;
+}
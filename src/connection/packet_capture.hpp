@@ -0,0 +1,169 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__CONNECTION__PACKET_CAPTURE_HPP
+#define BARIUMSULFATE__CONNECTION__PACKET_CAPTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Capture files
+// -------------
+// A capture holds the frames of every connection the server accepted while it
+// was on, in both directions, with timestamps. It starts with the 8 byte magic
+// "BSCAPTR1" and the time the capture started (microseconds since the epoch,
+// 8 bytes). Every record after that is
+//
+//     time        8 bytes, microseconds since the capture started
+//     connection  4 bytes, numbered from 1 in the order of accepting
+//     event       1 byte, see capture_event
+//     flags       1 byte, capture_compressed if the frame is in the compressed
+//                 format (the uncompressed length in front of the packet)
+//     size        4 bytes
+//     data        size bytes
+//
+// All numbers are little endian. The data of inbound and outbound records is a
+// frame as it is on the wire without the length prefix, decrypted, but still
+// compressed if it was. open and close records have no data.
+
+enum class capture_event : uint8_t { open, close, inbound, outbound };
+
+constexpr uint8_t capture_compressed = 1;
+
+/**
+ * Writes a capture file. Records are buffered and appended to the file in
+ * large writes, the buffer is flushed when it's full and when the capture is
+ * destroyed. If a write fails (a full disk) the capture logs it, drops what it
+ * had buffered and records nothing from then on, it never throws at the server.
+ *
+ * Thread safe. The server captures through the capture that is installed, each
+ * connection picks it up when it starts.
+ */
+class packet_capture : private boost::noncopyable
+{
+public:
+    // Creates or truncates the file, throws if that fails
+    explicit packet_capture(const std::string& path);
+    ~packet_capture();
+
+    // The capture connections record to, nullptr (the default) to capture
+    // nothing. The capture has to outlive the connections that use it.
+    static void install(packet_capture* capture)
+    {
+        installed_.store(capture, std::memory_order_release);
+    }
+
+    static packet_capture* installed()
+    {
+        return installed_.load(std::memory_order_acquire);
+    }
+
+    // A number for a new connection
+    uint32_t next_connection()
+    {
+        return next_connection_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Records an event of a connection. The data of the record is data followed
+    // by more, more_size may be 0.
+    void record(uint32_t connection, capture_event event, uint8_t flags,
+        const uint8_t* data = nullptr, size_t size = 0, const uint8_t* more = nullptr, size_t more_size = 0);
+
+    // Writes the buffered records to the file
+    void flush();
+
+    // Records that made it into the file or the buffer
+    uint64_t records() const
+    {
+        return records_.load(std::memory_order_relaxed);
+    }
+
+    // Records lost to a failed write, and all records after it
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t buffer_size = 1 << 20;
+
+    void write_buffer();
+    void fail();
+
+    static std::atomic<packet_capture*> installed_;
+
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<uint32_t> next_connection_;
+    std::atomic<uint64_t> records_;
+    std::atomic<uint64_t> dropped_;
+
+    // mutex_ protects the members below
+    std::mutex mutex_;
+    std::FILE* file_;
+    std::vector<uint8_t> buffer_;
+    uint64_t buffered_records_;
+    bool failed_;
+};
+
+/**
+ * A record read back from a capture file
+ */
+struct capture_record
+{
+    uint64_t time;  // microseconds since the capture started
+    uint32_t connection;
+    capture_event event;
+    uint8_t flags;
+    std::vector<uint8_t> data;
+
+    // The packet in the frame, decompressed if it was compressed
+    std::vector<uint8_t> packet() const;
+};
+
+/**
+ * Reads a capture file record by record
+ */
+class capture_reader : private boost::noncopyable
+{
+public:
+    // Opens the file and checks the header, throws if that fails
+    explicit capture_reader(const std::string& path);
+    ~capture_reader();
+
+    // Reads the next record, false at the end of the file. Throws on a record
+    // that is cut off.
+    bool next(capture_record& record);
+
+    // When the capture started, microseconds since the epoch
+    uint64_t start_time() const
+    {
+        return start_time_;
+    }
+
+private:
+    std::FILE* file_;
+    uint64_t start_time_;
+};
+
+#endif
@@ -16,28 +16,128 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include <boost/asio.hpp>
 
+#include <connection/authenticator.hpp>
 #include <connection/connection.hpp>
+#include <connection/packet_capture.hpp>
 #include <misc/log.hpp>
 #include <server/io_service_pool.hpp>
 #include <server/server.hpp>
+#include <world/world.hpp>
 
-int main()
+namespace
 {
+
+// SIGUSR1 turns on every debug category, SIGUSR2 turns them all off again
+void watch_debug_signals(boost::asio::signal_set& signals)
+{
+    signals.async_wait([&signals](const boost::system::error_code& e, int signal)
+        {
+            if (e)
+                return;
+            log::set_debug_mask(signal == SIGUSR1 ? 0xFFFFFFFFFFFFFFFFLL : 0);
+            LOG_NOTICE("debug mask set to", log::debug_mask());
+            watch_debug_signals(signals);
+        });
+}
+
+}
+
+// usage: bariumsulfate [--online] [--capture <file>]
+//
+// --online  runs the online mode login, see below. Without it the server runs
+//           in offline mode, players are who they say they are.
+// --capture records the frames of every connection to file for bench_replay,
+//           see packet_capture.hpp
+int main(int argc, char** argv)
+{
+    bool online = false;
+    const char* capture_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--online")
+            online = true;
+        else if (arg == "--capture" && i + 1 < argc)
+            capture_path = argv[++i];
+        else
+        {
+            std::cerr << "usage: bariumsulfate [--online] [--capture <file>]" << std::endl;
+            return 2;
+        }
+    }
+
     try
     {
         log::stream(std::cout, log::level::debug);
         log::stream("bariumsulfate.log", log::level::debug);
-        log::notice("Starting Bariumsulfate");
+        LOG_NOTICE("Starting Bariumsulfate");
+
+        // Declared before everything that holds connections, it has to outlive them
+        std::unique_ptr<packet_capture> capture;
+        if (capture_path)
+        {
+            capture.reset(new packet_capture{capture_path});
+            packet_capture::install(capture.get());
+            LOG_NOTICE("Capturing connections to", capture_path);
+        }
+
+        // Online mode checks the server hash against the stub session service in
+        // strict mode, so only joins registered with it pass. Until we talk to a
+        // real session service nobody outside the process can log in that way,
+        // which is why it has to be asked for.
+        stub_session_service sessions{true};
+        std::unique_ptr<authenticator> auth;
+        if (online)
+        {
+            auth.reset(new authenticator{sessions});
+            LOG_WARNING("Online mode against the stub session service, players connecting from outside",
+                "the process will fail to verify");
+        }
+        else
+            LOG_NOTICE("Offline mode, players are not authenticated");
 
+        // Declared before the world, the connections the world holds on to use
+        // its io_services until the world is gone
         io_service_pool io_pool{2};
-        server<connection, void*> s{io_pool, "0.0.0.0", "25565", nullptr};
+
+        // Packets from 256 bytes on are compressed, chunks on two threads. Level 3
+        // compresses chunks about 3.5 times faster than the default 6, for about a
+        // fifth more bytes (see bench_compression).
+        world w{boost::thread::hardware_concurrency(), compression_config{256, 3, 2}, auth.get()};
+        w.start();
+
+        // At most 1000 connections, 16 from one address, and an address opens
+        // 4 connections a second with bursts of up to 20 (a few pings and logins).
+        // Both io threads accept, so a login storm isn't held up by one of them.
+        server<connection, world*> s{io_pool, "0.0.0.0", "25565", &w, admission_config{1000, 16, 4, 20},
+            accept_mode::per_thread};
+
+        boost::asio::signal_set debug_signals{io_pool.get_io_service(), SIGUSR1, SIGUSR2};
+        watch_debug_signals(debug_signals);
+
+        // A clean stop on SIGINT and SIGTERM, so the log and the capture are
+        // written out completely
+        boost::asio::signal_set stop_signals{io_pool.get_io_service(), SIGINT, SIGTERM};
+        stop_signals.async_wait([&io_pool](const boost::system::error_code& e, int)
+            {
+                if (e)
+                    return;
+                LOG_NOTICE("Stopping Bariumsulfate");
+                io_pool.stop();
+            });
+
         io_pool.run();
+
+        // No more ticks sending to the connections once the io threads are done
+        w.stop();
     }
     catch (...)
     {
-        log::error("Unhandled exception reached main");
+        LOG_ERROR("Unhandled exception reached main");
     }
 }
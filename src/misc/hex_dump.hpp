@@ -0,0 +1,57 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__MISC__HEX_DUMP_HPP
+#define BARIUMSULFATE__MISC__HEX_DUMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Bytes that are written to a stream as a hexdump, 16 bytes per line. Nothing
+// is formatted until it is streamed, and then straight into the stream. It only
+// points at the bytes, so stream it before they go away.
+struct hex_dump
+{
+    const uint8_t* data;
+    size_t size;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const hex_dump& dump)
+{
+    static const char digits[] = "0123456789abcdef";
+    char line[16 * 3];
+
+    out << '\n';
+    for (size_t i = 0; i < dump.size; i += 16)
+    {
+        if (i > 0)
+            out << '\n';
+
+        size_t n = dump.size - i < 16 ? dump.size - i : 16;
+        for (size_t j = 0; j < n; j++)
+        {
+            line[j * 3] = digits[dump.data[i + j] >> 4];
+            line[j * 3 + 1] = digits[dump.data[i + j] & 0xF];
+            line[j * 3 + 2] = ' ';
+        }
+        out.write(line, static_cast<std::streamsize>(n * 3));
+    }
+    return out;
+}
+
+#endif
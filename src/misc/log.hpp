@@ -18,77 +18,162 @@
 #ifndef BARIUMSULFATE__MISC__LOG_HPP
 #define BARIUMSULFATE__MISC__LOG_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <fstream>
-#include <boost/date_time.hpp>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
 
-// DE allows you to write expressions that do not get evaluated in release mode
-// useful for excessive debug logging calls
-#ifdef NDEBUG
-#  define DE(x)
-#else
-#  define DE(x) (x)
+#include <misc/record_ring.hpp>
+
+// The most verbose level that is compiled in: 0 error, 1 warning, 2 notice,
+// 3 info, 4 debug. Calls through the LOG_ macros above it are removed entirely.
+#ifndef BARIUMSULFATE_LOG_LEVEL
+#  define BARIUMSULFATE_LOG_LEVEL 4
 #endif
 
+// The LOG_ macros check whether anybody wants the record before the arguments
+// are evaluated, a disabled call costs two relaxed loads and a branch. Use them
+// wherever an argument is expensive to compute, like a hexdump of a packet.
+#define BARIUMSULFATE_LOG(ll, d, f, ...) \
+    do { \
+        if (static_cast<int>(ll) <= BARIUMSULFATE_LOG_LEVEL && log::enabled(ll, d)) \
+            log::f(__VA_ARGS__); \
+    } while (0)
+
+#define LOG_ERROR(...)   BARIUMSULFATE_LOG(log::level::error, log::dbg::general, error, __VA_ARGS__)
+#define LOG_WARNING(...) BARIUMSULFATE_LOG(log::level::warning, log::dbg::general, warning, __VA_ARGS__)
+#define LOG_NOTICE(...)  BARIUMSULFATE_LOG(log::level::notice, log::dbg::general, notice, __VA_ARGS__)
+#define LOG_INFO(...)    BARIUMSULFATE_LOG(log::level::info, log::dbg::general, info, __VA_ARGS__)
+#define LOG_DEBUG(d, ...) BARIUMSULFATE_LOG(log::level::debug, d, debug, d, __VA_ARGS__)
 
+
+// Logging is asynchronous. The logging thread turns its arguments into text
+// right away and puts the text in a ring of its own, a writer thread picks the
+// records up from all rings every few milliseconds, puts them in time order,
+// adds the timestamps and writes them to the streams in one go per batch. A
+// record that doesn't fit in the ring of its thread is dropped and counted, the
+// writer reports the drops in the log.
+//
+// Records are only written once the writer gets to them, call flush() to wait
+// for that. Whatever is logged before the program exits normally is written.
+//
+// Debug records are logged for the categories that are both in the flags of a
+// stream and in the debug mask. The mask can be changed at any time, it starts
+// out with every category in debug builds and with none in release builds.
 class log
 {
 public:
     enum class level {none = -1, error, warning, notice, info, debug};
-    enum class dbg {general, connection, packet};
+    enum class dbg {general, connection, packet, world};
 
 
     template <typename... T>
-    static void error(T... t)
+    static void error(const T&... t)
     {
         instance().write(level::error, dbg::general, t...);
     }
     
     template <typename... T>
-    static void warning(T... t)
+    static void warning(const T&... t)
     {
         instance().write(level::warning, dbg::general, t...);
     }
     
     template <typename... T>
-    static void notice(T... t)
+    static void notice(const T&... t)
     {
         instance().write(level::notice, dbg::general, t...);
     }
     
     template <typename... T>
-    static void info(T... t)
+    static void info(const T&... t)
     {
         instance().write(level::info, dbg::general, t...);
     }
     
     template <typename... T>
-    static void debug(dbg d, T... t)
+    static void debug(dbg d, const T&... t)
     {
         instance().write(level::debug, d, t...);
     }
 
     static void stream(std::ostream& stream, level l, uint64_t d = 0xFFFFFFFFFFFFFFFFLL)
     {
-        boost::lock_guard<boost::mutex> lock(instance().mutex_);
-        instance().logs_.push_back(stream_data{l, stream, d});
+        instance().add_stream(stream_data{l, stream, d});
     }
 
     static void stream(const std::string& name, level l, uint64_t d = 0xFFFFFFFFFFFFFFFFLL)
     {
         std::shared_ptr<std::ofstream> file{new std::ofstream(name, std::fstream::app)};
-        bool success = *file;
+        bool success = static_cast<bool>(*file);
 
         if (success)
         {
-            boost::lock_guard<boost::mutex> lock(instance().mutex_);
+            std::lock_guard<std::mutex> lock(instance().streams_mutex_);
             instance().files_.push_back(file);
-            instance().logs_.push_back(stream_data{l, *file, d});
         }
         else
             throw std::runtime_error("failed to open log file for appending. Wrong permissions?");
+
+        instance().add_stream(stream_data{l, *file, d});
+    }
+
+    // true if a stream wants records of this level and category, cheap enough to
+    // call before every record
+    static bool enabled(level ll, dbg d)
+    {
+        log& l = instance();
+        if (static_cast<int>(ll) > l.max_level_.load(std::memory_order_relaxed))
+            return false;
+        return ll != level::debug || should_log(ll, d,
+            l.debug_flags_.load(std::memory_order_relaxed) & l.debug_mask_.load(std::memory_order_relaxed));
+    }
+
+    // Bit 1 << dbg for every debug category that is logged
+    static void set_debug_mask(uint64_t mask)
+    {
+        instance().debug_mask_.store(mask, std::memory_order_relaxed);
+    }
+
+    static uint64_t debug_mask()
+    {
+        return instance().debug_mask_.load(std::memory_order_relaxed);
+    }
+
+    // Blocks until everything that was logged before the call is written
+    static void flush()
+    {
+        log& l = instance();
+        std::unique_lock<std::mutex> lock(l.writer_mutex_);
+        uint64_t request = ++l.flush_requested_;
+        l.wake_.notify_one();
+        l.flushed_cv_.wait(lock, [&l, request] { return l.flushed_ >= request; });
+    }
+
+    // Number of records that were dropped because the ring of their thread was full
+    static uint64_t dropped()
+    {
+        return instance().dropped_.load(std::memory_order_relaxed);
     }
 
 private:
+    // Size of the ring of every thread that logs, and the longest text a single
+    // record holds. Longer texts are cut off.
+    static constexpr size_t ring_size = 256 * 1024;
+    static constexpr size_t max_text = 8192;
+
     struct stream_data
     {
         log::level level;
@@ -96,56 +181,324 @@ private:
         uint64_t debug_flags; 
     };
 
-    log()
+    struct record_header
     {
+        int64_t time;   // microseconds since the epoch
+        level ll;
+        dbg d;
+    };
+
+    // The ring of a thread. The writer forgets it once the thread is gone and
+    // the ring is empty.
+    struct thread_ring
+    {
+        thread_ring() : ring{ring_size}, dropped{0}, abandoned{false}
+        {
+        }
+
+        record_ring ring;
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> abandoned;
+    };
+
+    // Appends everything written to it to a string that keeps its capacity
+    class text_buffer : public std::streambuf
+    {
+    public:
+        std::string text;
+
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if (c != traits_type::eof())
+                text.push_back(static_cast<char>(c));
+            return c;
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            text.append(s, static_cast<size_t>(n));
+            return n;
+        }
+    };
+
+    // What a logging thread keeps between calls
+    struct thread_state
+    {
+        thread_state() : ring{std::make_shared<thread_ring>()}, out{&buffer}, flags{out.flags()}
+        {
+            buffer.text.reserve(256);
+            instance().add_ring(ring);
+        }
+
+        ~thread_state()
+        {
+            ring->abandoned.store(true, std::memory_order_release);
+        }
+
+        // Starts a new record, formatting flags left behind by the last one
+        // are reset
+        std::ostream& begin()
+        {
+            buffer.text.clear();
+            out.flags(flags);
+            out.width(0);
+            out.precision(6);
+            out.fill(' ');
+            return out;
+        }
+
+        std::shared_ptr<thread_ring> ring;
+        text_buffer buffer;
+        std::ostream out;
+        std::ios_base::fmtflags flags;
+    };
+
+    // A record on its way from the rings to the streams, the text is in the
+    // batch arena
+    struct entry
+    {
+        record_header header;
+        size_t offset;
+        size_t size;
+    };
+
+    log() : max_level_{static_cast<int>(level::none)}, debug_flags_{0},
+#ifdef NDEBUG
+        debug_mask_{0},
+#else
+        debug_mask_{0xFFFFFFFFFFFFFFFFLL},
+#endif
+        dropped_{0},
+        flush_requested_{0}, flushed_{0}, stopping_{false}, last_second_{-1}
+    {
+        writer_ = std::thread{[this] { run(); }};
+    }
+
+    ~log()
+    {
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
     }
 
     log(const log&) = delete;
     log& operator=(const log&) = delete;
     
-    void write(std::ostream& l)
+    void format(std::ostream&)
     {
-        l << std::endl;
     }
 
     template <typename H>
-    void write(std::ostream& l, H head)
+    void format(std::ostream& l, const H& head)
     {
-        l << head << std::endl;
+        l << head;
     }
 
     template <typename H, typename... T>
-    void write(std::ostream& l, H head, T... tail)
+    void format(std::ostream& l, const H& head, const T&... tail)
     {
         l << head << " ";
-        write(l, tail...);
+        format(l, tail...);
     }
     
     template <typename... T>
-    void write(level ll, dbg d, T... t)
+    void write(level ll, dbg d, const T&... t)
+    {
+        // Nobody listens, don't bother formatting
+        if (!enabled(ll, d))
+            return;
+
+        thread_state& state = local();
+        format(state.begin(), t...);
+        push(state, ll, d);
+    }
+
+    // Not in write(), every instantiation of it would get a ring of its own
+    static thread_state& local()
+    {
+        thread_local thread_state state;
+        return state;
+    }
+
+    void push(thread_state& state, level ll, dbg d)
+    {
+        std::string& text = state.buffer.text;
+        if (text.size() > max_text)
+        {
+            text.resize(max_text - 3);
+            text += "...";
+        }
+
+        uint8_t* p = state.ring->ring.reserve(sizeof(record_header) + text.size());
+        if (!p)
+        {
+            state.ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        record_header header{std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count(), ll, d};
+        std::memcpy(p, &header, sizeof(header));
+        std::memcpy(p + sizeof(header), text.data(), text.size());
+        state.ring->ring.commit();
+    }
+
+    void add_stream(const stream_data& s)
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        logs_.push_back(s);
+        if (static_cast<int>(s.level) > max_level_.load(std::memory_order_relaxed))
+            max_level_.store(static_cast<int>(s.level), std::memory_order_relaxed);
+        if (s.level == level::debug)
+            debug_flags_.fetch_or(s.debug_flags, std::memory_order_relaxed);
+    }
+
+    void add_ring(const std::shared_ptr<thread_ring>& ring)
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(ring);
+    }
+
+    // The writer thread
+    void run()
     {
-        boost::lock_guard<boost::mutex> lock(mutex_);
-        std::string ts = timestamp(ll);
+        std::unique_lock<std::mutex> lock(writer_mutex_);
+        for (;;)
+        {
+            bool stopping = stopping_;
+            uint64_t request = flush_requested_;
+            lock.unlock();
+
+            size_t written = drain();
+
+            lock.lock();
+            if (request > flushed_)
+            {
+                flushed_ = request;
+                flushed_cv_.notify_all();
+            }
+            if (stopping)
+                return;
+            // Nothing came in, look again in a few milliseconds
+            if (!written)
+                wake_.wait_for(lock, std::chrono::milliseconds(5), [this, request] {
+                    return stopping_ || flush_requested_ != request; });
+        }
+    }
+
+    // Moves every record from the rings to the streams
+    // return -> number of records written
+    size_t drain()
+    {
+        batch_.clear();
+        arena_.clear();
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            for (auto it = rings_.begin(); it != rings_.end();)
+            {
+                thread_ring& r = **it;
+                // Read before consuming, the thread pushes nothing after setting it
+                bool abandoned = r.abandoned.load(std::memory_order_acquire);
+                r.ring.consume([this](const uint8_t* data, size_t size)
+                    {
+                        entry e;
+                        std::memcpy(&e.header, data, sizeof(e.header));
+                        e.offset = arena_.size();
+                        e.size = size - sizeof(e.header);
+                        arena_.insert(arena_.end(), data + sizeof(e.header), data + size);
+                        batch_.push_back(e);
+                    });
+
+                uint64_t dropped = r.dropped.exchange(0, std::memory_order_relaxed);
+                if (dropped)
+                    report_dropped(dropped);
+
+                if (abandoned)
+                    it = rings_.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        if (batch_.empty())
+            return 0;
+
+        // Every ring is in order already, but the threads are interleaved
+        std::stable_sort(batch_.begin(), batch_.end(), [](const entry& a, const entry& b) {
+            return a.header.time < b.header.time; });
+
+        uint64_t mask = debug_mask_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(streams_mutex_);
         for (auto l : logs_)
-            if (l.level >= ll && should_log(ll, d, l.debug_flags)) 
-                write(l.stream, ts, t...);
+        {
+            out_.clear();
+            for (auto& e : batch_)
+            {
+                if (l.level >= e.header.ll && should_log(e.header.ll, e.header.d, l.debug_flags & mask))
+                {
+                    timestamp(e.header.time, e.header.ll, out_);
+                    out_ += ' ';
+                    out_.append(arena_.data() + e.offset, e.size);
+                    out_ += '\n';
+                }
+            }
+            l.stream.write(out_.data(), static_cast<std::streamsize>(out_.size()));
+            l.stream.flush();
+        }
+        return batch_.size();
     }
 
-    static std::string timestamp(level ll)
+    void report_dropped(uint64_t dropped)
     {
-        std::ostringstream s;
-        s << "[" << boost::posix_time::microsec_clock::universal_time() << "]";
+        dropped_.fetch_add(dropped, std::memory_order_relaxed);
+
+        entry e;
+        e.header = record_header{std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count(), level::warning, dbg::general};
+        std::string text = "dropped " + std::to_string(dropped) + " log records, the ring of their thread was full";
+        e.offset = arena_.size();
+        e.size = text.size();
+        arena_.insert(arena_.end(), text.begin(), text.end());
+        batch_.push_back(e);
+    }
+
+    // Appends the timestamp and level in the format boost::posix_time prints, the
+    // date and time are only formatted again when the second changes
+    void timestamp(int64_t time, level ll, std::string& out)
+    {
+        int64_t second = time / 1000000;
+        if (second != last_second_)
+        {
+            static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+            std::time_t t = static_cast<std::time_t>(second);
+            std::tm tm;
+            gmtime_r(&t, &tm);
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "[%04d-%s-%02d %02d:%02d:%02d.", tm.tm_year + 1900,
+                months[tm.tm_mon], tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+            second_text_ = buf;
+            last_second_ = second;
+        }
+
+        char micros[16];
+        std::snprintf(micros, sizeof(micros), "%06d]", static_cast<int>(time % 1000000));
+        out += second_text_;
+        out += micros;
+
         switch (ll)
         {
-        case log::level::error:   s << "  <Error>   "; break;
-        case log::level::warning: s << "  <Warning> "; break;
-        case log::level::notice:  s << "  <Notice>  "; break;
-        case log::level::info:    s << "  <Info>    "; break;
-        case log::level::debug:   s << "  <Debug>   "; break;
+        case log::level::error:   out += "  <Error>   "; break;
+        case log::level::warning: out += "  <Warning> "; break;
+        case log::level::notice:  out += "  <Notice>  "; break;
+        case log::level::info:    out += "  <Info>    "; break;
+        case log::level::debug:   out += "  <Debug>   "; break;
         case log::level::none: break;
         }
-
-        return s.str();
     }
 
     static bool should_log(level ll, dbg d, uint64_t flags)
@@ -162,9 +515,35 @@ private:
         return l;
     }
     
+    // streams_mutex_ protects logs_ and files_, the levels they want are
+    // summarized in max_level_ and debug_flags_ so threads can skip records
+    // nobody wants without locking
+    std::mutex streams_mutex_;
     std::vector<stream_data> logs_;
     std::vector<std::shared_ptr<std::ofstream>> files_;
-    boost::mutex mutex_;
+    std::atomic<int> max_level_;
+    std::atomic<uint64_t> debug_flags_;
+    std::atomic<uint64_t> debug_mask_;
+
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<thread_ring>> rings_;
+    std::atomic<uint64_t> dropped_;
+
+    // writer_mutex_ protects the flush and stop requests
+    std::mutex writer_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_cv_;
+    uint64_t flush_requested_;
+    uint64_t flushed_;
+    bool stopping_;
+    std::thread writer_;
+
+    // Only touched by the writer
+    std::vector<entry> batch_;
+    std::vector<char> arena_;
+    std::string out_;
+    int64_t last_second_;
+    std::string second_text_;
 };
 
 #endif
@@ -0,0 +1,143 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__MISC__MPSC_QUEUE_HPP
+#define BARIUMSULFATE__MISC__MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// An unbounded multi producer, single consumer queue (Dmitry Vyukov's node based
+// design). push is lock free and never blocks, it can be called from any thread.
+// pop, empty and the destructor may only be called by the consumer.
+//
+// Nodes are recycled through a small free list per thread. Nodes are released by
+// the consumer, so a producer that never consumes still allocates its nodes, but
+// the consumer thread reuses them for its own pushes.
+//
+// T must be default constructible and movable.
+template <typename T>
+class mpsc_queue : private boost::noncopyable
+{
+public:
+    mpsc_queue() : head_{new node}, tail_{head_.load(std::memory_order_relaxed)}
+    {
+    }
+
+    ~mpsc_queue()
+    {
+        T value;
+        while (pop(value))
+            ;
+        delete tail_;
+    }
+
+    void push(T value)
+    {
+        node* n = acquire_node();
+        n->value = std::move(value);
+        n->next.store(nullptr, std::memory_order_relaxed);
+
+        node* prev = head_.exchange(n, std::memory_order_acq_rel);
+        // Between the exchange and this store the consumer can't see n yet, pop
+        // returns false while empty() already returns false.
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // Takes the oldest element off the queue
+    // return -> false if the queue is empty, or if a push is halfway done
+    bool pop(T& value)
+    {
+        node* tail = tail_;
+        node* next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+
+        // next becomes the new stub, its value is moved out so it doesn't hold on
+        // to anything
+        value = std::move(next->value);
+        tail_ = next;
+        release_node(tail);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_;
+    }
+
+private:
+    // Nodes a thread keeps around for reuse
+    static constexpr size_t max_cached_nodes = 1024;
+
+    struct node
+    {
+        node() : next{nullptr}
+        {
+        }
+
+        std::atomic<node*> next;
+        T value;
+    };
+
+    struct node_cache
+    {
+        ~node_cache()
+        {
+            for (node* n : nodes)
+                delete n;
+        }
+
+        std::vector<node*> nodes;
+    };
+
+    static node_cache& cache()
+    {
+        static thread_local node_cache c;
+        return c;
+    }
+
+    static node* acquire_node()
+    {
+        auto& nodes = cache().nodes;
+        if (nodes.empty())
+            return new node;
+
+        node* n = nodes.back();
+        nodes.pop_back();
+        return n;
+    }
+
+    static void release_node(node* n)
+    {
+        auto& nodes = cache().nodes;
+        if (nodes.size() < max_cached_nodes)
+            nodes.push_back(n);
+        else
+            delete n;
+    }
+
+    // head_ is where producers add nodes, tail_ is the stub node the consumer
+    // takes the next node from. Keep them on separate cache lines.
+    std::atomic<node*> head_;
+    char padding_[64 - sizeof(std::atomic<node*>)];
+    node* tail_;
+};
+
+#endif
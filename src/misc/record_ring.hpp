@@ -0,0 +1,137 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__MISC__RECORD_RING_HPP
+#define BARIUMSULFATE__MISC__RECORD_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// A bounded single producer, single consumer ring of variable sized records.
+// The producer reserves space for a record, fills it in and commits it, the
+// consumer walks over every committed record in order. Neither side blocks or
+// allocates, reserve fails when the ring doesn't have room for the record.
+//
+// Records are stored contiguously with an 8 byte header. A record that doesn't
+// fit before the end of the buffer leaves a skip marker there and starts over
+// at the front.
+class record_ring : private boost::noncopyable
+{
+public:
+    // capacity in bytes, rounded up to a power of two
+    explicit record_ring(size_t capacity) : head_{0}, tail_{0}, reserved_{0}
+    {
+        size_t size = 64;
+        while (size < capacity)
+            size <<= 1;
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    // Returns space for a record of size bytes, or nullptr if the ring is full.
+    // Only the producer calls this, commit() makes the record visible.
+    uint8_t* reserve(size_t size)
+    {
+        size_t total = record_size(size);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t free = buffer_.size() - (tail - head_.load(std::memory_order_acquire));
+        size_t to_end = buffer_.size() - (tail & mask_);
+
+        if (total > to_end)
+        {
+            if (to_end + total > free)
+                return nullptr;
+            write_header(tail, skip);
+            tail += to_end;
+        }
+        else if (total > free)
+            return nullptr;
+
+        write_header(tail, static_cast<uint32_t>(size));
+        reserved_ = tail + total;
+        return &buffer_[(tail & mask_) + header_size];
+    }
+
+    void commit()
+    {
+        tail_.store(reserved_, std::memory_order_release);
+    }
+
+    // Calls f(data, size) for every committed record and frees their space
+    // afterwards. Only the consumer calls this.
+    // return -> number of records
+    template <typename F>
+    size_t consume(F f)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t count = 0;
+
+        while (head != tail)
+        {
+            uint32_t size;
+            std::memcpy(&size, &buffer_[head & mask_], sizeof(size));
+            if (size == skip)
+            {
+                head += buffer_.size() - (head & mask_);
+                continue;
+            }
+
+            f(&buffer_[(head & mask_) + header_size], static_cast<size_t>(size));
+            head += record_size(size);
+            count++;
+        }
+
+        head_.store(head, std::memory_order_release);
+        return count;
+    }
+
+    size_t capacity() const
+    {
+        return buffer_.size();
+    }
+
+private:
+    static constexpr size_t header_size = 8;
+    static constexpr uint32_t skip = 0xFFFFFFFF;
+
+    static size_t record_size(size_t size)
+    {
+        return (header_size + size + 7) & ~static_cast<size_t>(7);
+    }
+
+    void write_header(size_t pos, uint32_t size)
+    {
+        std::memcpy(&buffer_[pos & mask_], &size, sizeof(size));
+    }
+
+    std::vector<uint8_t> buffer_;
+    size_t mask_;
+    // head_ is advanced by the consumer, tail_ by the producer. Keep them on
+    // separate cache lines.
+    std::atomic<size_t> head_;
+    char padding_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    // Where the tail goes on commit, producer only
+    size_t reserved_;
+};
+
+#endif
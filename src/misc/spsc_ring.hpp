@@ -0,0 +1,92 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__MISC__SPSC_RING_HPP
+#define BARIUMSULFATE__MISC__SPSC_RING_HPP
+
+#include <atomic>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// A bounded single producer, single consumer ring buffer. push and pop never
+// block or allocate, push fails when the ring is full and pop fails when it's
+// empty. push may only be called by one thread and pop by one (other) thread.
+//
+// T must be default constructible and movable. Popped slots are reset to T() so
+// the ring doesn't keep anything alive that was taken out of it.
+template <typename T>
+class spsc_ring : private boost::noncopyable
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity) : head_{0}, tail_{0}
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    bool push(T value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+            return false;
+
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+
+        T& slot = slots_[head & mask_];
+        value = std::move(slot);
+        slot = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Number of elements in the ring, only exact when called by the producer or
+    // consumer while the other side is idle
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return slots_.size();
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_;
+    // head_ is advanced by the consumer, tail_ by the producer. Keep them on
+    // separate cache lines.
+    std::atomic<size_t> head_;
+    char padding_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+};
+
+#endif
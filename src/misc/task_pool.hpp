@@ -0,0 +1,193 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__MISC__TASK_POOL_HPP
+#define BARIUMSULFATE__MISC__TASK_POOL_HPP
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * A pool of worker threads for splitting up one batch of work at a time, like the
+ * regions of a world tick. Where the io_service_pool hands out independent
+ * io_services, the task_pool runs a single parallel_for at a time and returns
+ * once all of it is done.
+ *
+ * Every worker has its own queue of task indices. The tasks are dealt out round
+ * robin, a worker takes tasks from the back of its own queue and steals from the
+ * front of the other queues once its own queue is empty, so a few expensive tasks
+ * don't leave the other threads idle.
+ */
+class task_pool : private boost::noncopyable
+{
+public:
+    /**
+     * \param[in] threads Number of threads that work on a parallel_for, including
+     *                    the thread that calls it. With 1 (or 0) the pool starts no
+     *                    threads and runs everything on the calling thread.
+     */
+    explicit task_pool(std::size_t threads) :
+        queues_(threads ? threads : 1), job_(nullptr), remaining_{0}, generation_{0}, stop_{false}
+    {
+        for (std::size_t i = 1; i < queues_.size(); ++i)
+            workers_.create_thread(boost::bind(&task_pool::work, this, i));
+    }
+
+    ~task_pool()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        workers_.join_all();
+    }
+
+    std::size_t size() const
+    {
+        return queues_.size();
+    }
+
+    /**
+     * Invokes f(i) for every i in [0, n) spread over the threads of the pool and
+     * returns when all invocations are done. Only one thread may call this at a
+     * time and f must not throw.
+     */
+    template <typename F>
+    void parallel_for(std::size_t n, F f)
+    {
+        if (n == 0)
+            return;
+
+        if (queues_.size() == 1 || n == 1)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                f(i);
+            return;
+        }
+
+        std::function<void(std::size_t)> job{[&f](std::size_t i) { f(i); }};
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            job_ = &job;
+            remaining_ = n;
+            generation_++;
+        }
+        // job_ is published before any task becomes visible through the queue locks
+        for (std::size_t q = 0; q < queues_.size(); ++q)
+        {
+            boost::lock_guard<boost::mutex> lock(queues_[q].mutex);
+            for (std::size_t i = q; i < n; i += queues_.size())
+                queues_[q].tasks.push_back(i);
+        }
+        start_.notify_all();
+
+        run_tasks(0);
+
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (remaining_.load() != 0)
+            done_.wait(lock);
+        job_ = nullptr;
+    }
+
+private:
+    struct queue
+    {
+        boost::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    void work(std::size_t self)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex_);
+                while (!stop_ && generation_ == seen)
+                    start_.wait(lock);
+                if (stop_)
+                    return;
+                seen = generation_;
+            }
+            run_tasks(self);
+        }
+    }
+
+    void run_tasks(std::size_t self)
+    {
+        std::size_t task;
+        while (take(self, task))
+        {
+            (*job_)(task);
+            if (remaining_.fetch_sub(1) == 1)
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                done_.notify_all();
+            }
+        }
+    }
+
+    bool take(std::size_t self, std::size_t& task)
+    {
+        {
+            queue& own = queues_[self];
+            boost::lock_guard<boost::mutex> lock(own.mutex);
+            if (own.tasks.size())
+            {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < queues_.size(); ++i)
+        {
+            queue& victim = queues_[(self + i) % queues_.size()];
+            boost::lock_guard<boost::mutex> lock(victim.mutex);
+            if (victim.tasks.size())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<queue> queues_;
+    boost::thread_group workers_;
+
+    // mutex_ protects job_, generation_ and stop_ and goes with the condition
+    // variables
+    boost::mutex mutex_;
+    boost::condition_variable start_;
+    boost::condition_variable done_;
+    const std::function<void(std::size_t)>* job_;
+    std::atomic<std::size_t> remaining_;
+    uint64_t generation_;
+    bool stop_;
+};
+
+#endif
@@ -19,141 +19,164 @@
 #define BARIUMSULFATE__PROTOCOL__BUFFER_HPP
 
 #include <algorithm>
-#include <iomanip>
+#include <cstring>
 #include <stdexcept>
-#include <sstream>
+#include <string>
 #include <type_traits>
+#include <vector>
 
+#include <misc/hex_dump.hpp>
+#include <protocol/endian.hpp>
 #include <protocol/varint.hpp>
 
+// A growable buffer that packets are written to and read from with << and >>.
+// Numbers are big endian. The buffer grows by doubling and is never shrunk, so
+// writing a pooled packet doesn't allocate or touch the allocator at all; size()
+// is how far the buffer was written.
 class byte_stream
 {
 public:
-    byte_stream() : pos_{0}
+    byte_stream() : pos_{0}, size_{0}
     {
-        data_.reserve(512);
+        data_.resize(512);
+    }
+
+    explicit byte_stream(size_t reserve) : pos_{0}, size_{0}
+    {
+        data_.resize(std::max(reserve, size_t{16}));
     }
     
     byte_stream(byte_stream&& rhs) noexcept : 
-        pos_{rhs.pos_}, data_{std::move(rhs.data_)}
+        pos_{rhs.pos_}, size_{rhs.size_}, data_{std::move(rhs.data_)}
     {
+        rhs.pos_ = rhs.size_ = 0;
     }
 
-    byte_stream(const byte_stream& rhs) noexcept :
-        pos_{rhs.pos_}, data_{rhs.data_}
+    byte_stream(const byte_stream& rhs) :
+        pos_{rhs.pos_}, size_{rhs.size_}, data_{rhs.data_}
     {
     }
     
-    const std::vector<uint8_t>& data()
+    const uint8_t* data() const
     {
-        return data_;
+        return data_.data();
     }
 
-    void resize(size_t s) 
+    // Sets the number of bytes in the stream, new bytes are 0
+    void resize(size_t s)
     {
-        data_.resize(s);
+        if (s > data_.size())
+            grow(s);
+        if (s > size_)
+            std::memset(data_.data() + size_, 0, s - size_);
+        size_ = s;
     }
 
     size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
     {
         return data_.size();
     }
 
-    size_t write(const uint8_t* src, size_t len, bool reverse)
+    // Empties the stream but keeps the memory around for the next packet
+    void clear()
     {
-        if (pos_ + len > data_.size())
-            data_.resize(pos_ + len);
-        
-        std::vector<uint8_t>::iterator end;
-        if (reverse)
-            end = std::reverse_copy(src, src + len, data_.begin() + pos_);
-        else
-            end = std::copy(src, src + len, data_.begin() + pos_);
-        size_t rlen = static_cast<size_t>(end - (data_.begin() + pos_));
-        pos_ += rlen;
-        return rlen;
+        size_ = 0;
+        pos_ = 0;
     }
 
-    byte_stream& operator<<(bool src)
+    // Makes room for len bytes at the current position and moves past them, the
+    // caller fills them in through the returned pointer
+    uint8_t* append(size_t len)
     {
-        uint8_t byte = static_cast<uint8_t>(src);
-        write(&byte, 1, false);
-        return *this;
+        size_t end = pos_ + len;
+        if (end > data_.size())
+            grow(end);
+        uint8_t* dst = data_.data() + pos_;
+        pos_ = end;
+        if (end > size_)
+            size_ = end;
+        return dst;
     }
-    
+
+    void write(const uint8_t* src, size_t len)
+    {
+        if (len)
+            std::memcpy(append(len), src, len);
+    }
+
+    // n numbers in big endian
     template <typename T>
-    byte_stream& operator<<(const varint<T>& src)
+    void write_be(const T* src, size_t n)
     {
-        T value = src;
-        
-        uint8_t byte;
-        while (value >= 0x80)
-        {
-            byte = static_cast<uint8_t>(value & 0x7F) | 0x80;
-            value >>= 7;
-            write(&byte, 1, false);
-        }
-        byte = static_cast<uint8_t>(value);
-        write(&byte, 1, false);
+        endian::store_be(append(n * sizeof(T)), src, n);
+    }
 
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, byte_stream&>::type operator<<(T src)
+    {
+        endian::store_be(append(sizeof(T)), src);
         return *this;
     }
-    
-    byte_stream& operator<<(const std::string& src)
+
+    template <typename T>
+    byte_stream& operator<<(const varint<T>& src)
     {
-        varint<size_t> len{src.length()};
-        *this << len;
-        write(reinterpret_cast<const uint8_t*>(src.data()), src.length(), false);
+        auto value = varint_codec::to_unsigned(static_cast<T>(src));
+        varint_codec::encode(append(varint_codec::size(value)), value);
         return *this;
     }
     
-    template <typename T>
-    byte_stream& operator<<(const T& src)
+    byte_stream& operator<<(const std::string& src)
     {
-        write(reinterpret_cast<const uint8_t*>(&src), sizeof(T), std::is_integral<T>());
+        uint8_t* dst = append(varint_codec::size(src.size()) + src.size());
+        dst = varint_codec::encode(dst, src.size());
+        std::memcpy(dst, src.data(), src.size());
         return *this;
     }
 
-    size_t read(uint8_t* dst, size_t len, bool reverse)
+    // Reads len bytes, they have to be there
+    const uint8_t* consume(size_t len)
     {
-        if (pos_ + len > data_.size())
+        if (pos_ > size_ || len > size_ - pos_)
             throw std::runtime_error("Trying to read past buffer of byte_stream.");
+        const uint8_t* src = data_.data() + pos_;
+        pos_ += len;
+        return src;
+    }
 
-        uint8_t* end;
-        if (reverse)
-            end = std::reverse_copy(data_.begin() + pos_, data_.begin() + pos_ + len, dst);
-        else
-            end = std::copy(data_.begin() + pos_, data_.begin() + pos_ + len, dst);
-        size_t rlen = static_cast<size_t>(end - dst);
-        pos_ += rlen;
-        return rlen;
+    void read(uint8_t* dst, size_t len)
+    {
+        if (len)
+            std::memcpy(dst, consume(len), len);
     }
-    
+
     template <typename T>
-    byte_stream& operator>>(T& dst)
+    void read_be(T* dst, size_t n)
     {
-        uint8_t* buffer = reinterpret_cast<uint8_t*>(&dst);
-        size_t len = sizeof(T);
-        
-        read(buffer, len, std::is_integral<T>());
-        
-        return *this;
+        endian::load_be(consume(n * sizeof(T)), dst, n);
     }
     
-    byte_stream& operator>>(bool& dst)
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, byte_stream&>::type operator>>(T& dst)
     {
-        uint8_t byte;
-        read(&byte, 1, false);
-        dst = byte != 0;
+        dst = endian::load_be<T>(consume(sizeof(T)));
         return *this;
     }
      
     template <typename T>
     byte_stream& operator>>(varint<T>& dst)
     {
-        for (int i = 0; ; i++)
-            if (!dst.append_byte(data_[pos_++], i))
-                break;
+        T value = 0;
+        size_t len = pos_ < size_ ? varint_codec::decode(data_.data() + pos_, size_ - pos_, value) : 0;
+        if (!len)
+            throw std::runtime_error("Trying to read past buffer of byte_stream.");
+        dst = value;
+        pos_ += len;
         return *this;
     }
 
@@ -164,8 +187,8 @@ public:
         if (len > 4096)
             throw std::runtime_error("trying to read an unusually large string from byte_stream.");
         
-        dst.resize(len);
-        read(const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(dst.c_str())), len, false);
+        const uint8_t* src = consume(len);
+        dst.assign(reinterpret_cast<const char*>(src), len);
         return *this;
     }
 
@@ -179,22 +202,21 @@ public:
         pos_ = pos;
     }
 
-    std::string hexdump() const
+    // Formatted when it's streamed, see hex_dump
+    hex_dump hexdump() const
     {
-        std::stringstream ss;
-        ss << std::endl << std::hex;
-        for (size_t i = 0; i < data_.size(); i++)
-        {
-            if (i > 0 && i % 16 == 0)
-                ss << std::endl;
-            unsigned int val = data_.at(i);
-            ss << std::setw(2) << std::setfill('0') << val << " ";
-        }
-        return ss.str();
+        return hex_dump{data_.data(), size_};
     }
 
 private:
+    // Out of line, the writes only pay for a compare
+    __attribute__((noinline)) void grow(size_t needed)
+    {
+        data_.resize(std::max(needed, data_.size() * 2));
+    }
+
     size_t pos_;
+    size_t size_;
     std::vector<uint8_t> data_;
 };
 
@@ -0,0 +1,162 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__BYTE_VIEW_HPP
+#define BARIUMSULFATE__PROTOCOL__BYTE_VIEW_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <misc/hex_dump.hpp>
+#include <protocol/endian.hpp>
+#include <protocol/slab.hpp>
+#include <protocol/varint.hpp>
+
+// Reads from a range of bytes it doesn't own. byte_view supports the same >>
+// operators as byte_stream so packet handlers can decode straight from the
+// receive buffer of a connection. The bytes must outlive the view.
+class byte_view
+{
+public:
+    byte_view() : data_{nullptr}, size_{0}, pos_{0}
+    {
+    }
+
+    byte_view(const uint8_t* data, size_t size) : data_{data}, size_{size}, pos_{0}
+    {
+    }
+
+    const uint8_t* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // Reads len bytes, they have to be there
+    const uint8_t* consume(size_t len)
+    {
+        if (len > size_ - pos_)
+            throw std::runtime_error("Trying to read past buffer of byte_view.");
+        const uint8_t* src = data_ + pos_;
+        pos_ += len;
+        return src;
+    }
+
+    void read(uint8_t* dst, size_t len)
+    {
+        if (len)
+            std::memcpy(dst, consume(len), len);
+    }
+
+    // n numbers in big endian
+    template <typename T>
+    void read_be(T* dst, size_t n)
+    {
+        endian::load_be(consume(n * sizeof(T)), dst, n);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, byte_view&>::type operator>>(T& dst)
+    {
+        dst = endian::load_be<T>(consume(sizeof(T)));
+        return *this;
+    }
+
+    template <typename T>
+    byte_view& operator>>(varint<T>& dst)
+    {
+        T value = 0;
+        size_t len = varint_codec::decode(data_ + pos_, size_ - pos_, value);
+        if (!len)
+            throw std::runtime_error("Trying to read past buffer of byte_view.");
+        dst = value;
+        pos_ += len;
+        return *this;
+    }
+
+    byte_view& operator>>(std::string& dst)
+    {
+        varint<size_t> len;
+        *this >> len;
+        if (len > 4096)
+            throw std::runtime_error("trying to read an unusually large string from byte_view.");
+        if (len > size_ - pos_)
+            throw std::runtime_error("Trying to read past buffer of byte_view.");
+
+        dst.assign(reinterpret_cast<const char*>(data_ + pos_), len);
+        pos_ += len;
+        return *this;
+    }
+
+    size_t pos() const
+    {
+        return pos_;
+    }
+
+    // At most size(), reads rely on it
+    void pos(size_t pos)
+    {
+        if (pos > size_)
+            throw std::runtime_error("Trying to seek past buffer of byte_view.");
+        pos_ = pos;
+    }
+
+    // Formatted when it's streamed, see hex_dump
+    hex_dump hexdump() const
+    {
+        return hex_dump{data_, size_};
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_;
+};
+
+// A byte_view into a slab that keeps the slab alive. Copying a packet_view only
+// copies the view and bumps the reference count of the slab, which makes it the
+// cheap way to hold on to a received packet until the next world tick.
+class packet_view : public byte_view
+{
+public:
+    packet_view()
+    {
+    }
+
+    packet_view(slab_ptr s, const uint8_t* data, size_t size) :
+        byte_view{data, size}, slab_{std::move(s)}
+    {
+    }
+
+    // A view of part of another packet, keeping the same slab alive
+    packet_view(const packet_view& from, const uint8_t* data, size_t size) :
+        byte_view{data, size}, slab_{from.slab_}
+    {
+    }
+
+private:
+    slab_ptr slab_;
+};
+
+#endif
@@ -0,0 +1,212 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+
+#include <protocol/cfb8.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define BARIUMSULFATE_AESNI 1
+#  include <wmmintrin.h>
+#  define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+namespace
+{
+
+std::atomic<bool> hardware_disabled{false};
+
+#ifdef BARIUMSULFATE_AESNI
+
+bool cpu_has_aesni()
+{
+    static const bool has = __builtin_cpu_supports("aes");
+    return has;
+}
+
+AESNI_TARGET inline __m128i expand_step(__m128i key, __m128i generated)
+{
+    generated = _mm_shuffle_epi32(generated, _MM_SHUFFLE(3, 3, 3, 3));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, generated);
+}
+
+AESNI_TARGET void expand_key(const uint8_t* key, uint8_t* round_keys)
+{
+    __m128i k[11];
+    k[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    // The round constant has to be an immediate
+    k[1] = expand_step(k[0], _mm_aeskeygenassist_si128(k[0], 0x01));
+    k[2] = expand_step(k[1], _mm_aeskeygenassist_si128(k[1], 0x02));
+    k[3] = expand_step(k[2], _mm_aeskeygenassist_si128(k[2], 0x04));
+    k[4] = expand_step(k[3], _mm_aeskeygenassist_si128(k[3], 0x08));
+    k[5] = expand_step(k[4], _mm_aeskeygenassist_si128(k[4], 0x10));
+    k[6] = expand_step(k[5], _mm_aeskeygenassist_si128(k[5], 0x20));
+    k[7] = expand_step(k[6], _mm_aeskeygenassist_si128(k[6], 0x40));
+    k[8] = expand_step(k[7], _mm_aeskeygenassist_si128(k[7], 0x80));
+    k[9] = expand_step(k[8], _mm_aeskeygenassist_si128(k[8], 0x1B));
+    k[10] = expand_step(k[9], _mm_aeskeygenassist_si128(k[9], 0x36));
+    for (int i = 0; i < 11; i++)
+        _mm_store_si128(reinterpret_cast<__m128i*>(round_keys) + i, k[i]);
+}
+
+#endif
+
+}
+
+constexpr size_t cfb8::key_size;
+
+cfb8::cfb8(const uint8_t* key, mode m) :
+    mode_{m}, round_keys_(), register_(), ctx_{nullptr}
+{
+    std::memcpy(register_, key, key_size);
+
+#ifdef BARIUMSULFATE_AESNI
+    if (cpu_has_aesni() && !hardware_disabled.load(std::memory_order_relaxed))
+    {
+        expand_key(key, round_keys_);
+        return;
+    }
+#endif
+
+    ctx_ = EVP_CIPHER_CTX_new();
+    if (!ctx_ || !EVP_CipherInit_ex(ctx_, EVP_aes_128_cfb8(), nullptr, key, key, m == mode::encrypt ? 1 : 0))
+    {
+        EVP_CIPHER_CTX_free(ctx_);
+        throw std::runtime_error("Could not set up AES/CFB8.");
+    }
+}
+
+cfb8::~cfb8()
+{
+    EVP_CIPHER_CTX_free(ctx_);
+}
+
+void cfb8::disable_hardware(bool disable)
+{
+    hardware_disabled.store(disable, std::memory_order_relaxed);
+}
+
+void cfb8::apply(const uint8_t* in, uint8_t* out, size_t n)
+{
+    if (ctx_)
+    {
+        int written = 0;
+        if (!EVP_CipherUpdate(ctx_, out, &written, in, static_cast<int>(n)))
+            throw std::runtime_error("AES/CFB8 failed.");
+        return;
+    }
+
+    if (mode_ == mode::encrypt)
+        encrypt_aesni(in, out, n);
+    else
+        decrypt_aesni(in, out, n);
+}
+
+#ifdef BARIUMSULFATE_AESNI
+
+#define AES_ROUNDS(x, keys) \
+    x = _mm_xor_si128(x, keys[0]); \
+    for (int r = 1; r < 10; r++) \
+        x = _mm_aesenc_si128(x, keys[r]); \
+    x = _mm_aesenclast_si128(x, keys[10]);
+
+// One block per byte: the first byte of the encrypted register is the key stream
+// byte, the ciphertext byte is shifted into the register.
+AESNI_TARGET void cfb8::encrypt_aesni(const uint8_t* in, uint8_t* out, size_t n)
+{
+    __m128i keys[11];
+    for (int i = 0; i < 11; i++)
+        keys[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(round_keys_) + i);
+    __m128i reg = _mm_load_si128(reinterpret_cast<const __m128i*>(register_));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        __m128i block = reg;
+        AES_ROUNDS(block, keys)
+        uint8_t c = static_cast<uint8_t>(in[i] ^ static_cast<uint8_t>(_mm_cvtsi128_si32(block)));
+        out[i] = c;
+        reg = _mm_or_si128(_mm_srli_si128(reg, 1), _mm_slli_si128(_mm_cvtsi32_si128(c), 15));
+    }
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(register_), reg);
+}
+
+// The register of byte i is the 16 ciphertext bytes in front of it, which we all
+// have, so eight blocks are encrypted side by side to hide the latency of the AES
+// instructions. window holds the 16 ciphertext bytes before the current batch and
+// the ciphertext of the batch, out may overwrite in.
+AESNI_TARGET void cfb8::decrypt_aesni(const uint8_t* in, uint8_t* out, size_t n)
+{
+    constexpr size_t batch = 8;
+    __m128i keys[11];
+    for (int i = 0; i < 11; i++)
+        keys[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(round_keys_) + i);
+
+    uint8_t window[16 + batch];
+    std::memcpy(window, register_, 16);
+
+    size_t i = 0;
+    for (; i + batch <= n; i += batch)
+    {
+        std::memcpy(window + 16, in + i, batch);
+        __m128i b[batch];
+        for (size_t j = 0; j < batch; j++)
+            b[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(window + j)), keys[0]);
+        for (int r = 1; r < 10; r++)
+            for (size_t j = 0; j < batch; j++)
+                b[j] = _mm_aesenc_si128(b[j], keys[r]);
+        for (size_t j = 0; j < batch; j++)
+        {
+            b[j] = _mm_aesenclast_si128(b[j], keys[10]);
+            out[i + j] = static_cast<uint8_t>(window[16 + j] ^ static_cast<uint8_t>(_mm_cvtsi128_si32(b[j])));
+        }
+        std::memmove(window, window + batch, 16);
+    }
+
+    for (; i < n; i++)
+    {
+        uint8_t c = in[i];
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(window));
+        AES_ROUNDS(block, keys)
+        out[i] = static_cast<uint8_t>(c ^ static_cast<uint8_t>(_mm_cvtsi128_si32(block)));
+        std::memmove(window, window + 1, 15);
+        window[15] = c;
+    }
+
+    std::memcpy(register_, window, 16);
+}
+
+#undef AES_ROUNDS
+
+#else
+
+void cfb8::encrypt_aesni(const uint8_t*, uint8_t*, size_t)
+{
+}
+
+void cfb8::decrypt_aesni(const uint8_t*, uint8_t*, size_t)
+{
+}
+
+#endif
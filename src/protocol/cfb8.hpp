@@ -0,0 +1,72 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__CFB8_HPP
+#define BARIUMSULFATE__PROTOCOL__CFB8_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/noncopyable.hpp>
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+/**
+ * AES-128 in CFB8 mode, the stream cipher of an encrypted connection. The shared
+ * secret is both the key and the initial vector. Each direction of a connection
+ * has its own cfb8, the state carries over from one call to the next.
+ *
+ * CFB8 needs an AES block per byte. Encrypting can't be parallelized, every
+ * block depends on the ciphertext byte before it. Decrypting can: the blocks
+ * only depend on ciphertext that is already there, so with AES-NI eight of them
+ * go through the AES rounds together. Without AES-NI OpenSSL does the work.
+ */
+class cfb8 : private boost::noncopyable
+{
+public:
+    enum class mode {encrypt, decrypt};
+
+    static constexpr size_t key_size = 16;
+
+    cfb8(const uint8_t* key, mode m);
+    ~cfb8();
+
+    // Encrypts or decrypts n bytes from in to out, in and out may be the same
+    void apply(const uint8_t* in, uint8_t* out, size_t n);
+
+    // true if the CPU has AES-NI and this cfb8 uses it
+    bool hardware() const
+    {
+        return ctx_ == nullptr;
+    }
+
+    // Forces the OpenSSL path, for comparing the two
+    static void disable_hardware(bool disable);
+
+private:
+    void encrypt_aesni(const uint8_t* in, uint8_t* out, size_t n);
+    void decrypt_aesni(const uint8_t* in, uint8_t* out, size_t n);
+
+    mode mode_;
+    // The AES-128 key schedule for AES-NI
+    alignas(16) uint8_t round_keys_[11 * 16];
+    // The last 16 ciphertext bytes
+    alignas(16) uint8_t register_[16];
+    EVP_CIPHER_CTX* ctx_;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include <protocol/compression.hpp>
+
+namespace
+{
+
+// A raw deflate stream per thread and level, deflateInit allocates a couple of
+// hundred kilobytes so we only want to do that once.
+class deflater
+{
+public:
+    explicit deflater(int level) : stream_()
+    {
+        if (deflateInit2(&stream_, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("deflateInit2 failed.");
+    }
+
+    ~deflater()
+    {
+        deflateEnd(&stream_);
+    }
+
+    static deflater& local(int level)
+    {
+        static thread_local std::vector<std::unique_ptr<deflater>> deflaters(Z_BEST_COMPRESSION + 1);
+        level = std::max(Z_BEST_SPEED, std::min(Z_BEST_COMPRESSION, level));
+        std::unique_ptr<deflater>& d = deflaters[static_cast<size_t>(level)];
+        if (!d)
+            d.reset(new deflater{level});
+        return *d;
+    }
+
+    // Compresses data and appends it to out, ending with a sync flush
+    void segment(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+    {
+        deflateReset(&stream_);
+        size_t start = out.size();
+        out.resize(start + deflateBound(&stream_, size) + 16);
+
+        stream_.next_in = const_cast<Bytef*>(data);
+        stream_.avail_in = static_cast<uInt>(size);
+        stream_.next_out = out.data() + start;
+        stream_.avail_out = static_cast<uInt>(out.size() - start);
+        if (deflate(&stream_, Z_SYNC_FLUSH) != Z_OK || stream_.avail_in != 0)
+            throw std::runtime_error("deflate failed.");
+        out.resize(out.size() - stream_.avail_out);
+    }
+
+private:
+    z_stream stream_;
+};
+
+}
+
+deflate_segment compress_segment(const uint8_t* data, size_t size, int level)
+{
+    deflate_segment s;
+    deflater::local(level).segment(data, size, s.bytes);
+    s.adler = static_cast<uint32_t>(adler32(adler32(0, nullptr, 0), data, static_cast<uInt>(size)));
+    s.size = size;
+    return s;
+}
+
+zlib_builder::zlib_builder(std::vector<uint8_t>& out) :
+    out_(out), adler_{static_cast<uint32_t>(adler32(0, nullptr, 0))}, size_{0}
+{
+    // Deflate with a 32 KiB window, default level
+    out_.push_back(0x78);
+    out_.push_back(0x9C);
+}
+
+void zlib_builder::raw(const uint8_t* data, size_t size)
+{
+    adler_ = static_cast<uint32_t>(adler32(adler_, data, static_cast<uInt>(size)));
+    size_ += size;
+    do
+    {
+        // Stored block, not final: the header bits, then LEN and NLEN little endian
+        uint16_t len = static_cast<uint16_t>(std::min<size_t>(size, 0xFFFF));
+        uint8_t header[] = {0x00, static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8),
+            static_cast<uint8_t>(~len), static_cast<uint8_t>(~len >> 8)};
+        out_.insert(out_.end(), header, header + sizeof(header));
+        out_.insert(out_.end(), data, data + len);
+        data += len;
+        size -= len;
+    } while (size);
+}
+
+void zlib_builder::segment(const deflate_segment& s)
+{
+    out_.insert(out_.end(), s.bytes.begin(), s.bytes.end());
+    adler_ = static_cast<uint32_t>(adler32_combine(adler_, s.adler, static_cast<z_off_t>(s.size)));
+    size_ += s.size;
+}
+
+void zlib_builder::finish()
+{
+    // An empty final block with fixed codes, then the checksum big endian
+    const uint8_t tail[] = {0x03, 0x00, static_cast<uint8_t>(adler_ >> 24), static_cast<uint8_t>(adler_ >> 16),
+        static_cast<uint8_t>(adler_ >> 8), static_cast<uint8_t>(adler_)};
+    out_.insert(out_.end(), tail, tail + sizeof(tail));
+}
+
+void compress(const uint8_t* data, size_t size, int level, std::vector<uint8_t>& out)
+{
+    zlib_builder builder{out};
+    builder.segment(compress_segment(data, size, level));
+    builder.finish();
+}
+
+void decompress(const uint8_t* data, size_t size, uint8_t* out, size_t out_size)
+{
+    z_stream stream = z_stream();
+    if (inflateInit(&stream) != Z_OK)
+        throw std::runtime_error("inflateInit failed.");
+
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = out;
+    stream.avail_out = static_cast<uInt>(out_size);
+    int result = inflate(&stream, Z_FINISH);
+    size_t written = out_size - stream.avail_out;
+    inflateEnd(&stream);
+
+    // Z_BUF_ERROR means the output is full before the stream ended
+    if (result != Z_STREAM_END)
+        throw std::runtime_error("compressed packet is invalid or larger than it claims to be.");
+    if (written != out_size)
+        throw std::runtime_error("compressed packet is smaller than it claims to be.");
+}
@@ -0,0 +1,96 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__COMPRESSION_HPP
+#define BARIUMSULFATE__PROTOCOL__COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packet compression as negotiated by the set compression packet. Once it is on,
+// every frame carries the length of the uncompressed packet in front of the
+// packet, or 0 if the packet is sent as is.
+struct compression_config
+{
+    // Packets of at least this many bytes are compressed, smaller ones are sent
+    // uncompressed. -1 disables compression.
+    int threshold;
+    // zlib level, 1 (fastest) to 9 (smallest)
+    int level;
+    // Threads the world compresses chunks on, including the tick thread
+    size_t threads;
+
+    bool enabled() const
+    {
+        return threshold >= 0;
+    }
+
+    static compression_config disabled()
+    {
+        return compression_config{-1, 0, 1};
+    }
+};
+
+// A piece of a deflate stream: the compressed form of some bytes, ending on a byte
+// boundary without a final block. Segments can be compressed on their own (and
+// cached) and put together into one zlib stream later, see zlib_builder.
+struct deflate_segment
+{
+    std::vector<uint8_t> bytes;
+    uint32_t adler;  // adler32 of the uncompressed bytes
+    size_t size;     // number of uncompressed bytes
+};
+
+deflate_segment compress_segment(const uint8_t* data, size_t size, int level);
+
+// Puts a zlib stream together out of uncompressed bytes (written as stored blocks)
+// and deflate segments.
+class zlib_builder
+{
+public:
+    explicit zlib_builder(std::vector<uint8_t>& out);
+
+    // Appends bytes without compressing them, for short headers
+    void raw(const uint8_t* data, size_t size);
+
+    void segment(const deflate_segment& s);
+
+    // Ends the stream
+    void finish();
+
+    // Number of uncompressed bytes in the stream so far
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint32_t adler_;
+    size_t size_;
+};
+
+// Compresses data into a complete zlib stream
+void compress(const uint8_t* data, size_t size, int level, std::vector<uint8_t>& out);
+
+// Decompresses the zlib stream in [data, data + size) into exactly out_size bytes
+// at out. Throws if the stream is broken or doesn't decompress to exactly
+// out_size bytes, it never writes past out + out_size.
+void decompress(const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+
+#endif
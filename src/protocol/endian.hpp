@@ -0,0 +1,190 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__ENDIAN_HPP
+#define BARIUMSULFATE__PROTOCOL__ENDIAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Loads and stores of numbers in a given byte order, for single values and whole
+ * arrays. The protocol is big endian except for the block arrays of chunks,
+ * which are little endian.
+ *
+ * Values go through an unsigned integer of the same size with memcpy, which
+ * compiles to a plain (unaligned) load or store, and are swapped with the bswap
+ * builtins when the byte order differs from the host. Arrays in host order are a
+ * single memcpy, arrays that need swapping are a loop the compiler vectorizes.
+ *
+ * Only arithmetic types are accepted, a struct has no byte order.
+ */
+namespace endian
+{
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool host_is_big = true;
+#else
+constexpr bool host_is_big = false;
+#endif
+
+namespace detail
+{
+
+template <size_t N> struct uint_of;
+template <> struct uint_of<1> { typedef uint8_t type; };
+template <> struct uint_of<2> { typedef uint16_t type; };
+template <> struct uint_of<4> { typedef uint32_t type; };
+template <> struct uint_of<8> { typedef uint64_t type; };
+
+inline uint8_t bswap(uint8_t v)
+{
+    return v;
+}
+
+inline uint16_t bswap(uint16_t v)
+{
+    return __builtin_bswap16(v);
+}
+
+inline uint32_t bswap(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+inline uint64_t bswap(uint64_t v)
+{
+    return __builtin_bswap64(v);
+}
+
+template <typename T, bool big>
+inline void store(uint8_t* p, T value)
+{
+    static_assert(std::is_arithmetic<T>::value, "only numbers have a byte order");
+    typename uint_of<sizeof(T)>::type bits;
+    std::memcpy(&bits, &value, sizeof(T));
+    if (big != host_is_big)
+        bits = bswap(bits);
+    std::memcpy(p, &bits, sizeof(T));
+}
+
+template <typename T, bool big>
+inline T load(const uint8_t* p)
+{
+    static_assert(std::is_arithmetic<T>::value, "only numbers have a byte order");
+    typename uint_of<sizeof(T)>::type bits;
+    std::memcpy(&bits, p, sizeof(T));
+    if (big != host_is_big)
+        bits = bswap(bits);
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+template <typename T, bool big>
+inline void store(uint8_t* p, const T* src, size_t n)
+{
+    if (big == host_is_big || sizeof(T) == 1)
+    {
+        std::memcpy(p, src, n * sizeof(T));
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        store<T, big>(p + i * sizeof(T), src[i]);
+}
+
+template <typename T, bool big>
+inline void load(const uint8_t* p, T* dst, size_t n)
+{
+    if (big == host_is_big || sizeof(T) == 1)
+    {
+        std::memcpy(dst, p, n * sizeof(T));
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        dst[i] = load<T, big>(p + i * sizeof(T));
+}
+
+}
+
+template <typename T>
+inline void store_be(uint8_t* p, T value)
+{
+    detail::store<T, true>(p, value);
+}
+
+template <typename T>
+inline T load_be(const uint8_t* p)
+{
+    return detail::load<T, true>(p);
+}
+
+template <typename T>
+inline void store_le(uint8_t* p, T value)
+{
+    detail::store<T, false>(p, value);
+}
+
+template <typename T>
+inline T load_le(const uint8_t* p)
+{
+    return detail::load<T, false>(p);
+}
+
+// n values from src to p
+template <typename T>
+inline void store_be(uint8_t* p, const T* src, size_t n)
+{
+    detail::store<T, true>(p, src, n);
+}
+
+template <typename T>
+inline void load_be(const uint8_t* p, T* dst, size_t n)
+{
+    detail::load<T, true>(p, dst, n);
+}
+
+template <typename T>
+inline void store_le(uint8_t* p, const T* src, size_t n)
+{
+    detail::store<T, false>(p, src, n);
+}
+
+template <typename T>
+inline void load_le(const uint8_t* p, T* dst, size_t n)
+{
+    detail::load<T, false>(p, dst, n);
+}
+
+// bool is a byte, 0 or 1
+template <>
+inline void store_be<bool>(uint8_t* p, bool value)
+{
+    *p = value ? 1 : 0;
+}
+
+template <>
+inline bool load_be<bool>(const uint8_t* p)
+{
+    return *p != 0;
+}
+
+}
+
+#endif
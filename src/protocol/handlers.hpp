@@ -18,60 +18,88 @@
 #ifndef BARIUMSULFATE__PROTOCOL__HANDLERS_HPP
 #define BARIUMSULFATE__PROTOCOL__HANDLERS_HPP
 
-#include <connection/client.hpp>
+#include <initializer_list>
 #include <vector>
 
+#include <connection/client.hpp>
+#include <protocol/packets.hpp>
+#include <protocol/schema.hpp>
+
 constexpr int supported_protocol_version = 47;
 
-typedef void (client::*handler_fn)(byte_stream&);
+// Decodes the packet a handler takes and calls it, or hands over the raw packet
+typedef void (*handler_fn)(client&, byte_view&);
 
-enum class handler_type {instant, delayed};
+// instant:   handled on the io thread as soon as the packet arrives
+// delayed:   queued for the world tick, the client is disconnected if it floods
+//            its queue
+// droppable: like delayed, but dropped when the queue is full (for movement that
+//            is superseded by the next packet anyway)
+enum class handler_type {instant, delayed, droppable};
 
 struct handler_info {
     handler_type type;
     handler_fn fn;
 };
 
-std::vector<handler_info> fresh_handlers{
-    {handler_type::instant, &client::handle_handshake},       /* 0x00 - handshake */
-};
+template <typename P, void (client::*fn)(const P&)>
+void decode_and_handle(client& c, byte_view& data)
+{
+    P packet;
+    decode(data, packet);
+    (c.*fn)(packet);
+}
 
-std::vector<handler_info> login_handlers{
-    {handler_type::instant, &client::handle_login_start},     /* 0x00 - login start*/
-};
+template <void (client::*fn)(byte_view&)>
+void handle_raw(client& c, byte_view& data)
+{
+    (c.*fn)(data);
+}
 
-std::vector<handler_info> status_handlers{
-    {handler_type::instant, &client::handle_status_request},  /* 0x00 - status request */
-    {handler_type::instant, &client::handle_status_ping},     /* 0x01 - status ping */
+struct handler_entry {
+    unsigned int id;
+    handler_info info;
 };
 
-std::vector<handler_info> game_handlers{
-    {handler_type::instant, &client::unhandled_packet},       /* 0x00 - keep alive */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x01 - chat message */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x02 - use entity */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x03 - player ground state */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x04 - player position */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x05 - player look */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x06 - player position & look */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x07 - player dig */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x08 - player place block */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x09 - player switch current item */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0A - animation */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0B - entity action */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0C - steer vehicle */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0D - close window */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0E - click window */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x0F - confirm transaction */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x10 - creative inventory action */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x11 - enchant item */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x12 - update sign */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x13 - player flags */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x14 - tab complete */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x15 - client settings */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x16 - client status */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x17 - plugin message */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x18 - spectate */
-    {handler_type::instant, &client::unhandled_packet},       /* 0x19 - resource pack status */
-};
+// The table entry for packet P, at the id the packet declares
+template <typename P, void (client::*fn)(const P&)>
+handler_entry handle(handler_type type)
+{
+    unsigned int id = P::id;
+    return handler_entry{id, handler_info{type, &decode_and_handle<P, fn>}};
+}
+
+// A table of count opcodes, the ones without an entry go to unhandled_packet
+inline std::vector<handler_info> handler_table(unsigned int count, std::initializer_list<handler_entry> entries)
+{
+    std::vector<handler_info> table(count, handler_info{handler_type::instant, &handle_raw<&client::unhandled_packet>});
+    for (const handler_entry& e : entries)
+        table.at(e.id) = e.info;
+    return table;
+}
+
+std::vector<handler_info> fresh_handlers = handler_table(0x01, {
+    handle<packets::handshaking::handshake, &client::handle_handshake>(handler_type::instant),
+});
+
+std::vector<handler_info> login_handlers = handler_table(0x02, {
+    handle<packets::login::start, &client::handle_login_start>(handler_type::instant),
+    handle<packets::login::encryption_response, &client::handle_encryption_response>(handler_type::instant),
+});
+
+std::vector<handler_info> status_handlers = handler_table(0x02, {
+    handle<packets::status::request, &client::handle_status_request>(handler_type::instant),
+    handle<packets::status::ping, &client::handle_status_ping>(handler_type::instant),
+});
+
+// 0x01 - 0x02 and 0x07 - 0x19 (chat message up to resource pack status) aren't
+// handled yet
+std::vector<handler_info> game_handlers = handler_table(0x1A, {
+    handle<packets::play::keep_alive, &client::handle_keep_alive>(handler_type::instant),
+    handle<packets::play::player, &client::handle_player_ground>(handler_type::droppable),
+    handle<packets::play::player_position, &client::handle_player_position>(handler_type::droppable),
+    handle<packets::play::player_look, &client::handle_player_look>(handler_type::droppable),
+    handle<packets::play::player_position_look, &client::handle_player_position_look>(handler_type::droppable),
+});
 
 #endif
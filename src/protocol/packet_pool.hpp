@@ -0,0 +1,312 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__PACKET_POOL_HPP
+#define BARIUMSULFATE__PROTOCOL__PACKET_POOL_HPP
+
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <protocol/byte_stream.hpp>
+#include <protocol/compression.hpp>
+
+class packet_buffer;
+typedef boost::intrusive_ptr<packet_buffer> packet_ptr;
+
+// Hands out byte_streams for outbound packets. Released packets are emptied and
+// put on a free list of the thread that released them, grouped by the capacity
+// they have, so building a packet normally doesn't touch the allocator at all.
+//
+// Packets are mostly released by io threads once they are written to the socket,
+// so packets created on other threads (world ticks) end up on the free lists of
+// the io threads. The free lists are capped, anything beyond the cap is freed.
+class packet_pool : private boost::noncopyable
+{
+public:
+    // Number of size classes, the capacity of each class is 8 times the capacity of
+    // the previous one starting at 64 bytes (64, 512, 4096, 32768). Packets that
+    // grew beyond twice the largest class are freed instead of pooled.
+    static constexpr size_t class_count = 4;
+    // Maximum number of packets on the free list of each class
+    static constexpr size_t max_free = 256;
+
+    static size_t class_size(size_t c)
+    {
+        return size_t{64} << (3 * c);
+    }
+
+    // Get an empty packet that can hold at least size_hint bytes without growing
+    static packet_ptr acquire(size_t size_hint = 0);
+
+    // Return an unreferenced packet to the pool, called when the last packet_ptr
+    // to it goes away.
+    static void release(packet_buffer* p);
+
+private:
+    struct free_lists
+    {
+        ~free_lists();
+        std::array<std::vector<packet_buffer*>, class_count> lists;
+    };
+
+    static free_lists& local()
+    {
+        static thread_local free_lists l;
+        return l;
+    }
+
+    static size_t class_for(size_t size)
+    {
+        for (size_t c = 0; c < class_count; c++)
+            if (size <= class_size(c))
+                return c;
+        return class_count - 1;
+    }
+};
+
+// An outbound packet. The reference count is part of the object, so handing a
+// packet to a connection doesn't need a separate control block like a
+// std::shared_ptr would.
+//
+// Before a packet goes on the wire it is framed: its length prefix is encoded
+// once and stored with the packet. After that the packet is immutable and can be
+// queued on any number of connections without copying or re-encoding anything.
+//
+// A packet is framed for either an uncompressed connection (frame()) or for a
+// connection that uses compression (frame_compressed()), which adds the length of
+// the uncompressed packet and compresses the packet if it's large enough. All
+// connections a packet is queued on have to agree on that.
+class packet_buffer : public byte_stream, private boost::noncopyable
+{
+public:
+    // Encodes the length prefix. Calling this on a framed packet does nothing, it
+    // is safe to call from several threads at once.
+    void frame()
+    {
+        frame_once(false, [this]()
+        {
+            header_size_ = 0;
+            append_varint(size());
+        });
+    }
+
+    // Frames the packet for a connection with compression. Packets of at least
+    // threshold bytes are compressed at level here, on the calling thread.
+    void frame_compressed(int threshold, int level)
+    {
+        frame_once(true, [this, threshold, level]()
+        {
+            header_size_ = 0;
+            if (size() < static_cast<size_t>(threshold))
+            {
+                append_varint(size() + 1);
+                append_varint(0);
+                return;
+            }
+
+            compress(&data()[0], size(), level, compressed_);
+            append_varint(varint_size(size()) + compressed_.size());
+            append_varint(size());
+        });
+    }
+
+    // Frames the packet for a connection with compression, with the packet already
+    // compressed into body by the caller. uncompressed_size is the length of the
+    // packet before compression, the packet_buffer itself only has to hold what the
+    // caller wants to keep of it (nothing, or a header for debugging). Only call this
+    // before the packet is shared.
+    void frame_precompressed(std::vector<uint8_t>&& body, size_t uncompressed_size)
+    {
+        frame_once(true, [this, &body, uncompressed_size]()
+        {
+            compressed_ = std::move(body);
+            header_size_ = 0;
+            append_varint(varint_size(uncompressed_size) + compressed_.size());
+            append_varint(uncompressed_size);
+        });
+    }
+
+    bool framed() const
+    {
+        return framed_.load(std::memory_order_acquire) == frame_state::framed;
+    }
+
+    // true if the packet is framed for a connection with compression
+    bool compressed_format() const
+    {
+        return compressed_format_;
+    }
+
+    // The encoded length prefix (and uncompressed length), only valid once the
+    // packet is framed
+    const uint8_t* header() const
+    {
+        return header_;
+    }
+
+    size_t header_size() const
+    {
+        return header_size_;
+    }
+
+    // What goes on the wire after the header: the compressed packet if it was
+    // compressed, the packet itself otherwise. Only valid once the packet is framed.
+    const uint8_t* body()
+    {
+        return compressed_.empty() ? &data()[0] : compressed_.data();
+    }
+
+    size_t body_size() const
+    {
+        return compressed_.empty() ? size() : compressed_.size();
+    }
+
+    // Bytes on the wire, only valid once the packet is framed
+    size_t wire_size() const
+    {
+        return header_size_ + body_size();
+    }
+
+    friend void intrusive_ptr_add_ref(packet_buffer* p)
+    {
+        p->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(packet_buffer* p)
+    {
+        if (p->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            packet_pool::release(p);
+    }
+
+private:
+    friend class packet_pool;
+
+    struct frame_state
+    {
+        enum : uint8_t {unframed, framing, framed};
+    };
+
+    explicit packet_buffer(size_t reserve) :
+        byte_stream{reserve}, refs_{0}, framed_{frame_state::unframed}, compressed_format_{false},
+        header_size_{0}
+    {
+    }
+
+    void reset()
+    {
+        clear();
+        framed_.store(frame_state::unframed, std::memory_order_relaxed);
+        compressed_format_ = false;
+        header_size_ = 0;
+        compressed_.clear();
+    }
+
+    // Runs encode on the first call, later calls (from any thread) wait until the
+    // packet is framed
+    template <typename F>
+    void frame_once(bool compressed_format, F encode)
+    {
+        uint8_t state = framed_.load(std::memory_order_acquire);
+        if (state != frame_state::framed)
+        {
+            uint8_t expected = frame_state::unframed;
+            if (framed_.compare_exchange_strong(expected, frame_state::framing, std::memory_order_acquire))
+            {
+                compressed_format_ = compressed_format;
+                encode();
+                framed_.store(frame_state::framed, std::memory_order_release);
+            }
+            else
+            {
+                while (framed_.load(std::memory_order_acquire) != frame_state::framed)
+                    ;
+            }
+        }
+
+        if (compressed_format_ != compressed_format)
+            throw std::logic_error("packet is framed for another compression mode.");
+    }
+
+    void append_varint(size_t n)
+    {
+        header_size_ = static_cast<uint8_t>(varint_codec::encode(header_ + header_size_, n) - header_);
+    }
+
+    static size_t varint_size(size_t n)
+    {
+        return varint_codec::size(n);
+    }
+
+    std::atomic<unsigned int> refs_;
+    std::atomic<uint8_t> framed_;
+    bool compressed_format_;
+    // Packet length and, with compression, the uncompressed length
+    uint8_t header_[10];
+    uint8_t header_size_;
+    std::vector<uint8_t> compressed_;
+};
+
+inline packet_pool::free_lists::~free_lists()
+{
+    for (auto& list : lists)
+        for (packet_buffer* p : list)
+            delete p;
+}
+
+inline packet_ptr packet_pool::acquire(size_t size_hint /* = 0 */)
+{
+    size_t c = class_for(size_hint);
+    auto& list = local().lists[c];
+    if (list.empty())
+        return packet_ptr{new packet_buffer{std::max(size_hint, class_size(c))}};
+
+    packet_buffer* p = list.back();
+    list.pop_back();
+    return packet_ptr{p};
+}
+
+inline void packet_pool::release(packet_buffer* p)
+{
+    size_t capacity = std::max(p->capacity(), p->compressed_.capacity());
+    if (capacity > 2 * class_size(class_count - 1))
+    {
+        delete p;
+        return;
+    }
+
+    // Pool the packet in the largest class it can serve
+    size_t c = class_for(capacity);
+    if (c > 0 && capacity < class_size(c))
+        c--;
+
+    auto& list = local().lists[c];
+    if (list.size() >= max_free)
+    {
+        delete p;
+        return;
+    }
+
+    p->reset();
+    list.push_back(p);
+}
+
+#endif
@@ -0,0 +1,238 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__PACKETS_HPP
+#define BARIUMSULFATE__PROTOCOL__PACKETS_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <protocol/schema.hpp>
+#include <protocol/varint.hpp>
+
+// The protocol 47 (1.8) packets we speak, by state. See schema.hpp for how a
+// packet is declared.
+namespace packets
+{
+
+namespace handshaking
+{
+
+// serverbound
+struct handshake
+{
+    static constexpr unsigned int id = 0x00;
+    varint<int> protocol;
+    byte_array host;  // not copied, nothing uses it
+    uint16_t port;
+    varint<int> next_state;
+    PACKET_FIELDS(protocol, host, port, next_state)
+};
+
+}
+
+namespace status
+{
+
+// serverbound
+struct request
+{
+    static constexpr unsigned int id = 0x00;
+    PACKET_FIELDS()
+};
+
+// clientbound
+struct response
+{
+    static constexpr unsigned int id = 0x00;
+    std::string json;
+    PACKET_FIELDS(json)
+};
+
+// both ways, the server sends back what it got
+struct ping
+{
+    static constexpr unsigned int id = 0x01;
+    int64_t payload;
+    PACKET_FIELDS(payload)
+};
+
+}
+
+namespace login
+{
+
+// clientbound
+struct disconnect
+{
+    static constexpr unsigned int id = 0x00;
+    std::string reason;  // chat JSON
+    PACKET_FIELDS(reason)
+};
+
+// serverbound
+struct start
+{
+    static constexpr unsigned int id = 0x00;
+    std::string username;
+    PACKET_FIELDS(username)
+};
+
+// clientbound
+struct encryption_request
+{
+    static constexpr unsigned int id = 0x01;
+    std::string server_id;
+    byte_array public_key;
+    byte_array verify_token;
+    PACKET_FIELDS(server_id, public_key, verify_token)
+};
+
+// serverbound, both encrypted with the public key
+struct encryption_response
+{
+    static constexpr unsigned int id = 0x01;
+    byte_array shared_secret;
+    byte_array verify_token;
+    PACKET_FIELDS(shared_secret, verify_token)
+};
+
+// clientbound
+struct success
+{
+    static constexpr unsigned int id = 0x02;
+    std::string uuid;
+    std::string username;
+    PACKET_FIELDS(uuid, username)
+};
+
+// clientbound
+struct set_compression
+{
+    static constexpr unsigned int id = 0x03;
+    varint<int> threshold;
+    PACKET_FIELDS(threshold)
+};
+
+}
+
+namespace play
+{
+
+// both ways, the client answers with the id it got
+struct keep_alive
+{
+    static constexpr unsigned int id = 0x00;
+    varint<int32_t> keep_alive_id;
+    PACKET_FIELDS(keep_alive_id)
+};
+
+// clientbound
+struct join_game
+{
+    static constexpr unsigned int id = 0x01;
+    int32_t entity_id;
+    uint8_t game_mode;
+    int8_t dimension;
+    uint8_t difficulty;
+    uint8_t max_players;
+    std::string level_type;
+    bool reduced_debug_info;
+    PACKET_FIELDS(entity_id, game_mode, dimension, difficulty, max_players, level_type, reduced_debug_info)
+};
+
+// serverbound
+struct player
+{
+    static constexpr unsigned int id = 0x03;
+    bool on_ground;
+    PACKET_FIELDS(on_ground)
+};
+
+// serverbound
+struct player_position
+{
+    static constexpr unsigned int id = 0x04;
+    double x;
+    double y;  // of the feet
+    double z;
+    bool on_ground;
+    PACKET_FIELDS(x, y, z, on_ground)
+};
+
+// serverbound
+struct player_look
+{
+    static constexpr unsigned int id = 0x05;
+    float yaw;
+    float pitch;
+    bool on_ground;
+    PACKET_FIELDS(yaw, pitch, on_ground)
+};
+
+// serverbound
+struct player_position_look
+{
+    static constexpr unsigned int id = 0x06;
+    double x;
+    double y;
+    double z;
+    float yaw;
+    float pitch;
+    bool on_ground;
+    PACKET_FIELDS(x, y, z, yaw, pitch, on_ground)
+};
+
+// clientbound, positions in fixed point (1/32 block), angles in 1/256 of a turn
+struct entity_teleport
+{
+    static constexpr unsigned int id = 0x18;
+    varint<int32_t> entity_id;
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    uint8_t yaw;
+    uint8_t pitch;
+    bool on_ground;
+    PACKET_FIELDS(entity_id, x, y, z, yaw, pitch, on_ground)
+};
+
+// clientbound. A ground-up chunk without sections unloads the chunk. The chunk
+// cache writes the data of real chunks straight after the header fields.
+struct chunk_data
+{
+    static constexpr unsigned int id = 0x21;
+    int32_t x;
+    int32_t z;
+    bool ground_up;
+    uint16_t mask;
+    byte_array data;
+    PACKET_FIELDS(x, z, ground_up, mask, data)
+};
+
+// clientbound, a header per chunk followed by the data of all of them, the
+// chunk cache puts it together
+struct map_chunk_bulk
+{
+    static constexpr unsigned int id = 0x26;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,362 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__SCHEMA_HPP
+#define BARIUMSULFATE__PROTOCOL__SCHEMA_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <protocol/byte_view.hpp>
+#include <protocol/endian.hpp>
+#include <protocol/packet_pool.hpp>
+#include <protocol/varint.hpp>
+
+/*
+ Packet schemas
+ --------------
+ A packet is a struct with a static id and its fields in protocol order, listed
+ once more with PACKET_FIELDS:
+
+    struct set_compression
+    {
+        static constexpr unsigned int id = 0x03;
+        varint<int> threshold;
+        PACKET_FIELDS(threshold)
+    };
+
+ The field list is all encode() and decode() need. Each field type has a
+ field_codec that knows its size and how to read and write it without checks:
+
+    - encoding adds up the exact size of the packet, makes room for it in one go
+      and writes the fields straight into that memory
+    - decoding checks once that the smallest possible packet fits. Fields of a
+      fixed size are read without checks after that. A field of variable size
+      (VarInt, string, byte array) checks its own bytes and that whatever follows
+      still fits, so the fields behind it don't have to.
+
+ The field list expands to a call with every field as an argument, which the
+ encoder and decoder unpack recursively, the compiler turns that into straight
+ line code per packet.
+*/
+#define PACKET_FIELDS(...) \
+    template <typename F> void fields(F& f) { f(__VA_ARGS__); } \
+    template <typename F> void fields(F& f) const { f(__VA_ARGS__); }
+
+// A varint prefixed run of bytes. Decoding points it into the packet, so it's only
+// valid as long as the packet.
+struct byte_array
+{
+    byte_array() : data{nullptr}, size{0}
+    {
+    }
+
+    byte_array(const uint8_t* d, size_t s) : data{d}, size{s}
+    {
+    }
+
+    const uint8_t* data;
+    size_t size;
+};
+
+namespace schema
+{
+
+// Longest string we decode, in bytes
+constexpr size_t max_string_size = 4096;
+
+inline size_t varint_size(uint64_t n)
+{
+    return varint_codec::size(n);
+}
+
+inline uint8_t* write_varint(uint8_t* p, uint64_t n)
+{
+    return varint_codec::encode(p, n);
+}
+
+// At most max_bytes bytes, and never past end
+inline uint64_t read_varint(const uint8_t*& p, const uint8_t* end, size_t max_bytes)
+{
+    uint64_t value = 0;
+    size_t len = varint_codec::decode(p, static_cast<size_t>(end - p), max_bytes, value);
+    if (!len)
+        throw std::runtime_error("VarInt runs past the end of the packet.");
+    p += len;
+    return value;
+}
+
+template <typename T, typename Enable = void>
+struct field_codec;
+
+// Numbers in big endian, bool as a single byte
+template <typename T>
+struct field_codec<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    static constexpr bool fixed = true;
+    static constexpr size_t min_size = sizeof(T);
+
+    static size_t size(const T&)
+    {
+        return sizeof(T);
+    }
+
+    static uint8_t* write(uint8_t* p, const T& value)
+    {
+        endian::store_be(p, value);
+        return p + sizeof(T);
+    }
+
+    static void read(const uint8_t*& p, const uint8_t*, T& value)
+    {
+        value = endian::load_be<T>(p);
+        p += sizeof(T);
+    }
+};
+
+template <>
+struct field_codec<bool>
+{
+    static constexpr bool fixed = true;
+    static constexpr size_t min_size = 1;
+
+    static size_t size(bool)
+    {
+        return 1;
+    }
+
+    static uint8_t* write(uint8_t* p, bool value)
+    {
+        *p = value ? 1 : 0;
+        return p + 1;
+    }
+
+    static void read(const uint8_t*& p, const uint8_t*, bool& value)
+    {
+        value = *p++ != 0;
+    }
+};
+
+// Negative numbers take the full width, like the unsigned number with the same bits
+template <typename T>
+struct field_codec<varint<T>>
+{
+    typedef typename std::make_unsigned<T>::type unsigned_type;
+
+    static constexpr bool fixed = false;
+    static constexpr size_t min_size = 1;
+    static constexpr size_t max_size = (sizeof(T) * 8 + 6) / 7;
+
+    static size_t size(const varint<T>& value)
+    {
+        return varint_size(static_cast<unsigned_type>(static_cast<T>(value)));
+    }
+
+    static uint8_t* write(uint8_t* p, const varint<T>& value)
+    {
+        return write_varint(p, static_cast<unsigned_type>(static_cast<T>(value)));
+    }
+
+    static void read(const uint8_t*& p, const uint8_t* end, varint<T>& value)
+    {
+        value = static_cast<T>(static_cast<unsigned_type>(read_varint(p, end, max_size)));
+    }
+};
+
+template <>
+struct field_codec<std::string>
+{
+    static constexpr bool fixed = false;
+    static constexpr size_t min_size = 1;
+
+    static size_t size(const std::string& value)
+    {
+        return varint_size(value.size()) + value.size();
+    }
+
+    static uint8_t* write(uint8_t* p, const std::string& value)
+    {
+        p = write_varint(p, value.size());
+        std::memcpy(p, value.data(), value.size());
+        return p + value.size();
+    }
+
+    static void read(const uint8_t*& p, const uint8_t* end, std::string& value)
+    {
+        size_t size = static_cast<size_t>(read_varint(p, end, 5));
+        if (size > max_string_size)
+            throw std::runtime_error("trying to read an unusually large string from a packet.");
+        if (size > static_cast<size_t>(end - p))
+            throw std::runtime_error("string runs past the end of the packet.");
+        value.assign(reinterpret_cast<const char*>(p), size);
+        p += size;
+    }
+};
+
+template <>
+struct field_codec<byte_array>
+{
+    static constexpr bool fixed = false;
+    static constexpr size_t min_size = 1;
+
+    static size_t size(const byte_array& value)
+    {
+        return varint_size(value.size) + value.size;
+    }
+
+    static uint8_t* write(uint8_t* p, const byte_array& value)
+    {
+        p = write_varint(p, value.size);
+        if (value.size)
+            std::memcpy(p, value.data, value.size);
+        return p + value.size;
+    }
+
+    static void read(const uint8_t*& p, const uint8_t* end, byte_array& value)
+    {
+        size_t size = static_cast<size_t>(read_varint(p, end, 5));
+        if (size > static_cast<size_t>(end - p))
+            throw std::runtime_error("byte array runs past the end of the packet.");
+        value = byte_array{p, size};
+        p += size;
+    }
+};
+
+// Smallest encoded size of a list of fields
+template <typename... Ts>
+struct min_size;
+
+template <>
+struct min_size<>
+{
+    static constexpr size_t value = 0;
+};
+
+template <typename T, typename... Rest>
+struct min_size<T, Rest...>
+{
+    static constexpr size_t value = field_codec<T>::min_size + min_size<Rest...>::value;
+};
+
+struct size_counter
+{
+    size_t size;
+
+    void operator()()
+    {
+    }
+
+    template <typename T, typename... Rest>
+    void operator()(const T& first, const Rest&... rest)
+    {
+        size += field_codec<T>::size(first);
+        (*this)(rest...);
+    }
+};
+
+struct writer
+{
+    uint8_t* p;
+
+    void operator()()
+    {
+    }
+
+    template <typename T, typename... Rest>
+    void operator()(const T& first, const Rest&... rest)
+    {
+        p = field_codec<T>::write(p, first);
+        (*this)(rest...);
+    }
+};
+
+// Checks the minimum size of all fields up front, then only after each field of
+// variable size
+struct reader
+{
+    const uint8_t* p;
+    const uint8_t* end;
+
+    template <typename... Ts>
+    void operator()(Ts&... fields)
+    {
+        if (static_cast<size_t>(end - p) < min_size<Ts...>::value)
+            throw std::runtime_error("packet is too short.");
+        read(fields...);
+    }
+
+    void read()
+    {
+    }
+
+    template <typename T, typename... Rest>
+    void read(T& first, Rest&... rest)
+    {
+        field_codec<T>::read(p, end, first);
+        if (!field_codec<T>::fixed && static_cast<size_t>(end - p) < min_size<Rest...>::value)
+            throw std::runtime_error("packet is too short.");
+        read(rest...);
+    }
+};
+
+}
+
+// Encoded size of packet p, including its id
+template <typename P>
+size_t packet_size(const P& p)
+{
+    schema::size_counter counter{schema::varint_size(P::id)};
+    p.fields(counter);
+    return counter.size;
+}
+
+// Appends packet p to out, id first
+template <typename P>
+void encode(const P& p, byte_stream& out)
+{
+    uint8_t* dst = out.append(packet_size(p));
+    schema::writer w{schema::write_varint(dst, P::id)};
+    p.fields(w);
+}
+
+// A pooled packet with p in it, ready to send
+template <typename P>
+packet_ptr make_packet(const P& p)
+{
+    size_t size = packet_size(p);
+    packet_ptr packet = packet_pool::acquire(size);
+    schema::writer w{schema::write_varint(packet->append(size), P::id)};
+    p.fields(w);
+    return packet;
+}
+
+// Decodes the fields of packet p from data, which is past the id. Trailing bytes
+// are an error.
+template <typename P>
+void decode(byte_view& data, P& p)
+{
+    schema::reader r{data.data() + data.pos(), data.data() + data.size()};
+    p.fields(r);
+    if (r.p != r.end)
+        throw std::runtime_error("packet is longer than its fields.");
+    data.pos(data.size());
+}
+
+#endif
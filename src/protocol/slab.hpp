@@ -0,0 +1,91 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__PROTOCOL__SLAB_HPP
+#define BARIUMSULFATE__PROTOCOL__SLAB_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+// A fixed size, reference counted block of bytes. Connections receive into a slab
+// and packets that have to outlive the read handler (the ones handled in world
+// ticks) keep the slab alive by holding a reference to it, so they don't need a
+// buffer of their own.
+//
+// The data is allocated together with the header, a slab is only ever created
+// through slab::create and handled through a slab_ptr.
+class slab : private boost::noncopyable
+{
+public:
+    static boost::intrusive_ptr<slab> create(size_t capacity)
+    {
+        void* memory = ::operator new(sizeof(slab) + capacity);
+        return boost::intrusive_ptr<slab>{new (memory) slab{capacity}};
+    }
+
+    uint8_t* data()
+    {
+        return reinterpret_cast<uint8_t*>(this + 1);
+    }
+
+    const uint8_t* data() const
+    {
+        return reinterpret_cast<const uint8_t*>(this + 1);
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // true if the caller holds the only reference, which means nobody else is
+    // looking at the data and it can be overwritten.
+    bool unique() const
+    {
+        return refs_.load(std::memory_order_acquire) == 1;
+    }
+
+    friend void intrusive_ptr_add_ref(slab* s)
+    {
+        s->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(slab* s)
+    {
+        if (s->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            s->~slab();
+            ::operator delete(s);
+        }
+    }
+
+private:
+    explicit slab(size_t capacity) : refs_{0}, capacity_{capacity}
+    {
+    }
+
+    std::atomic<unsigned int> refs_;
+    size_t capacity_;
+};
+
+typedef boost::intrusive_ptr<slab> slab_ptr;
+
+#endif
@@ -18,8 +18,17 @@
 #ifndef BARIUMSULFATE__PROTOCOL__VARINT_HPP
 #define BARIUMSULFATE__PROTOCOL__VARINT_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#if defined(__BMI2__)
+#  include <immintrin.h>
+#endif
+
 // TODO: consider whether or not we need to support signed numbers.
 template<typename T>
 class varint
@@ -47,6 +56,8 @@ public:
     // b -> the byte to add
     // n -> the index of the byte in the sequence
     // return -> true if we expect more bytes, false if this number is done
+    //
+    // This doesn't bound anything, packets are read with varint_codec below.
     bool append_byte(uint8_t b, int n)
     {
         if (n == 0)
@@ -70,4 +81,143 @@ private:
     T value_;
 };
 
+/**
+ * Encoding and decoding VarInts (and VarLongs) in and out of memory the caller
+ * sized. Signed numbers are encoded as the unsigned number with the same bits,
+ * so negative numbers take the full width.
+ *
+ * Decoding is bounded twice: never past the available bytes and never more than
+ * the longest encoding of the type. With 8 bytes available (almost always, a
+ * VarInt is rarely at the very end of the receive buffer) it loads them at once,
+ * finds the last byte of the VarInt from the continuation bits and puts the
+ * groups of 7 bits together without a loop, with PEXT if the compiler may use
+ * BMI2 (-mbmi2 or a -march that has it).
+ */
+namespace varint_codec
+{
+
+// Longest encoding of a T, 5 bytes for 32 bits and 10 for 64 bits
+template <typename T>
+constexpr size_t max_size()
+{
+    return (sizeof(T) * 8 + 6) / 7;
+}
+
+template <typename T>
+typename std::make_unsigned<T>::type to_unsigned(T value)
+{
+    return static_cast<typename std::make_unsigned<T>::type>(value);
+}
+
+// Encoded size of n, one byte per started group of 7 bits
+inline size_t size(uint64_t n)
+{
+    return 1 + static_cast<size_t>(63 - __builtin_clzll(n | 1)) / 7;
+}
+
+// Writes n at p, which must have room for size(n) bytes
+inline uint8_t* encode(uint8_t* p, uint64_t n)
+{
+    if (n < 0x80)
+    {
+        *p = static_cast<uint8_t>(n);
+        return p + 1;
+    }
+    do
+    {
+        *p++ = static_cast<uint8_t>(n) | 0x80;
+        n >>= 7;
+    } while (n >= 0x80);
+    *p++ = static_cast<uint8_t>(n);
+    return p;
+}
+
+namespace detail
+{
+
+// Puts the low 7 bits of the bytes of x (little endian) next to each other
+inline uint64_t compact(uint64_t x)
+{
+#if defined(__BMI2__)
+    return _pext_u64(x, 0x7F7F7F7F7F7F7F7FULL);
+#else
+    x &= 0x7F7F7F7F7F7F7F7FULL;
+    x = ((x & 0x7F007F007F007F00ULL) >> 1) | (x & 0x007F007F007F007FULL);
+    x = ((x & 0x3FFF00003FFF0000ULL) >> 2) | (x & 0x00003FFF00003FFFULL);
+    x = ((x & 0x0FFFFFFF00000000ULL) >> 4) | (x & 0x000000000FFFFFFFULL);
+    return x;
+#endif
+}
+
+inline size_t decode_slow(const uint8_t* p, size_t available, size_t max_bytes, uint64_t& value)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < max_bytes; i++)
+    {
+        if (i == available)
+            return 0;
+        uint8_t b = p[i];
+        result |= static_cast<uint64_t>(b & 0x7F) << (7 * i);
+        if (!(b & 0x80))
+        {
+            value = result;
+            return i + 1;
+        }
+    }
+    throw std::runtime_error("VarInt is longer than allowed.");
+}
+
+}
+
+/**
+ * Decodes a VarInt of at most max_bytes bytes (at most 10) from the available
+ * bytes at p. Bits beyond 64 are dropped.
+ *
+ * \return bytes the VarInt takes, 0 if the available bytes end before it does
+ * \throws std::runtime_error if it's longer than max_bytes
+ */
+inline size_t decode(const uint8_t* p, size_t available, size_t max_bytes, uint64_t& value)
+{
+    // Opcodes, most lengths and small numbers
+    if (available && !(p[0] & 0x80))
+    {
+        value = p[0];
+        return 1;
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (available >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        uint64_t ends = ~word & 0x8080808080808080ULL;
+        if (ends)
+        {
+            size_t len = static_cast<size_t>(__builtin_ctzll(ends) >> 3) + 1;
+            if (len > max_bytes)
+                throw std::runtime_error("VarInt is longer than allowed.");
+            uint64_t keep = len == 8 ? ~0ULL : (1ULL << (len * 8)) - 1;
+            value = detail::compact(word & keep);
+            return len;
+        }
+        if (max_bytes <= 8)
+            throw std::runtime_error("VarInt is longer than allowed.");
+    }
+#endif
+    return detail::decode_slow(p, available, max_bytes, value);
+}
+
+// Decodes a T, bounded to the longest encoding of a T
+template <typename T>
+size_t decode(const uint8_t* p, size_t available, T& value)
+{
+    uint64_t raw = 0;
+    size_t len = decode(p, available, max_size<T>(), raw);
+    if (len)
+        value = static_cast<T>(static_cast<typename std::make_unsigned<T>::type>(raw));
+    return len;
+}
+
+}
+
 #endif
@@ -0,0 +1,147 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <boost/thread/lock_guard.hpp>
+
+#include <server/admission_control.hpp>
+
+namespace
+{
+
+// The address table is swept for addresses that don't tell us anything anymore
+// once it holds this many, or twice as many as after the last sweep
+constexpr size_t min_sweep_size = 1024;
+
+}
+
+const char* to_string(rejection reason)
+{
+    switch (reason)
+    {
+    case rejection::server_full:  return "server full";
+    case rejection::address_full: return "too many connections from address";
+    case rejection::rate_limited: return "rate limited";
+    }
+    return "unknown";
+}
+
+admission_control::admission_control(const admission_config& config) :
+    config_(config), open_{0}, next_sweep_{min_sweep_size}, admitted_{0}, rejected_{0, 0, 0}
+{
+    // A bucket has to hold at least one token, or nobody would ever get in
+    config_.burst = std::max(config_.burst, 1.0);
+}
+
+bool admission_control::admit(const boost::asio::ip::address& address, rejection& reason)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    if (config_.max_connections && open_ >= config_.max_connections)
+    {
+        reject(reason = rejection::server_full);
+        return false;
+    }
+
+    // Without limits per address there's nothing to keep track of
+    if (config_.max_per_address || config_.rate > 0)
+    {
+        clock::time_point now = clock::now();
+        if (addresses_.size() >= next_sweep_)
+            sweep(now);
+
+        auto inserted = addresses_.emplace(address, entry{config_.burst, now, 0});
+        entry& e = inserted.first->second;
+
+        if (config_.max_per_address && e.open >= config_.max_per_address)
+        {
+            reject(reason = rejection::address_full);
+            return false;
+        }
+
+        if (config_.rate > 0)
+        {
+            refill(e, now);
+            if (e.tokens < 1)
+            {
+                reject(reason = rejection::rate_limited);
+                return false;
+            }
+            e.tokens -= 1;
+        }
+        e.open++;
+    }
+
+    open_++;
+    admitted_++;
+    return true;
+}
+
+void admission_control::release(const boost::asio::ip::address& address)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    open_--;
+    auto it = addresses_.find(address);
+    if (it == addresses_.end())
+        return;
+
+    // Without a bucket an address with no connections left is forgotten right away
+    if (--it->second.open == 0 && config_.rate <= 0)
+        addresses_.erase(it);
+}
+
+admission_stats admission_control::stats()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    return admission_stats{
+        admitted_,
+        rejected_[static_cast<size_t>(rejection::server_full)],
+        rejected_[static_cast<size_t>(rejection::address_full)],
+        rejected_[static_cast<size_t>(rejection::rate_limited)],
+        open_,
+        addresses_.size()};
+}
+
+void admission_control::refill(entry& e, clock::time_point now) const
+{
+    std::chrono::duration<double> elapsed = now - e.refilled;
+    e.tokens = std::min(config_.burst, e.tokens + elapsed.count() * config_.rate);
+    e.refilled = now;
+}
+
+// Drops the addresses without open connections whose bucket is full again,
+// they would start over in the same state
+void admission_control::sweep(clock::time_point now)
+{
+    for (auto it = addresses_.begin(); it != addresses_.end();)
+    {
+        refill(it->second, now);
+        if (it->second.open == 0 && it->second.tokens >= config_.burst)
+            it = addresses_.erase(it);
+        else
+            ++it;
+    }
+    next_sweep_ = std::max(min_sweep_size, 2 * addresses_.size());
+}
+
+void admission_control::reject(rejection reason)
+{
+    rejected_[static_cast<size_t>(reason)]++;
+}
@@ -0,0 +1,109 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__SERVER__ADMISSION_CONTROL_HPP
+#define BARIUMSULFATE__SERVER__ADMISSION_CONTROL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Limits on accepted connections. A limit of 0 disables it, so admission_config{}
+ * admits everything.
+ */
+struct admission_config
+{
+    // Connections open at the same time, over all addresses
+    size_t max_connections;
+    // Connections open at the same time from one address
+    size_t max_per_address;
+    // Token bucket per address: new connections per second and the burst that
+    // is allowed on top of that after a quiet period
+    double rate;
+    double burst;
+};
+
+enum class rejection { server_full, address_full, rate_limited };
+
+const char* to_string(rejection reason);
+
+// Snapshot of the admission counters
+struct admission_stats
+{
+    uint64_t admitted;
+    uint64_t server_full;
+    uint64_t address_full;
+    uint64_t rate_limited;
+    // Connections that are admitted and not released yet
+    size_t open;
+    // Addresses we keep a bucket or a connection count for
+    size_t addresses;
+};
+
+/**
+ * Decides whether the server takes a freshly accepted socket, before anything
+ * is allocated for it. Admitted connections hold on to their slot until they
+ * are released, which the server does when the connection object goes away.
+ *
+ * Thread safe, connections are released from whatever thread drops the last
+ * reference to them.
+ */
+class admission_control : private boost::noncopyable
+{
+public:
+    explicit admission_control(const admission_config& config);
+
+    // Takes a slot for a connection from address if the limits allow it.
+    // reason -> set to the limit that was hit if it returns false
+    bool admit(const boost::asio::ip::address& address, rejection& reason);
+
+    // Gives back the slot of a connection that admit() let in
+    void release(const boost::asio::ip::address& address);
+
+    admission_stats stats();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct entry
+    {
+        double tokens;
+        clock::time_point refilled;
+        size_t open;
+    };
+
+    void refill(entry& e, clock::time_point now) const;
+    void sweep(clock::time_point now);
+    void reject(rejection reason);
+
+    admission_config config_;
+
+    // mutex_ protects everything below
+    boost::mutex mutex_;
+    std::map<boost::asio::ip::address, entry> addresses_;
+    size_t open_;
+    size_t next_sweep_;
+    uint64_t admitted_;
+    uint64_t rejected_[3];
+};
+
+#endif
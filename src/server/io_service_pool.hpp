@@ -102,6 +102,23 @@ public:
 		return io;
 	}
 
+	/**
+	 * Get the io_service with the given index, 0 to size() - 1. Unlike the round
+	 * robin get_io_service() this is thread safe.
+	 */
+	boost::asio::io_service& get_io_service(std::size_t index)
+	{
+		return *io_service_pool_[index];
+	}
+
+	/**
+	 * Number of io_service objects (and threads) in the pool
+	 */
+	std::size_t size() const
+	{
+		return io_service_pool_.size();
+	}
+
 	/**
 	 * stops all io_service objects from running, this will also shut down the
 	 * threads created for them in io_service
@@ -19,17 +19,39 @@
 #define BARIUMSULFATE__SERVER__SERVER_HPP
 
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 #include <string>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <misc/log.hpp>
+#include <server/admission_control.hpp>
 #include <server/io_service_pool.hpp>
 
+/**
+ * How a server accepts connections.
+ *
+ * single:     one acceptor on one io thread, which hands the connections out
+ *             to the io_services of the pool round robin
+ * per_thread: one acceptor per io_service, all bound to the same port with
+ *             SO_REUSEPORT. The kernel spreads incoming connections over them
+ *             and a connection stays on the thread that accepted it. Falls back
+ *             to single where SO_REUSEPORT doesn't exist.
+ */
+enum class accept_mode { single, per_thread };
+
 /**
  * A tcp server that assigns each connection to a different io_service from
  * an io_service_pool. Based on boost::asio example code.
  *
+ * Sockets are accepted bare and go through admission_control first, the
+ * connection object is only created for sockets that are admitted. The accepted
+ * socket is moved into the socket() of the new connection before start() is
+ * called. The connection keeps its admission slot until it is destroyed.
+ *
  * \tparam D Connection data type. The connection data is passed to each
  *           connection in its constructor.
  * \tparam C The connection type. The connection type must be at least:
@@ -69,45 +91,192 @@ public:
    * \param host    The ip/host to listen on.
    * \param service The port to listen on.
    * \param data    Some data that will be passed on to each connection
+   * \param limits  Limits on the connections that are admitted, none by default
+   * \param mode    One acceptor for the pool or one per io_service
    */
-	server(io_service_pool& io, const std::string host, const std::string service, D data) :
-		io_pool_(io), acceptor_(io.get_io_service()), connection_(), data_(data)
+	server(io_service_pool& io, const std::string host, const std::string service, D data,
+		const admission_config& limits = admission_config{}, accept_mode mode = accept_mode::single) :
+		io_pool_(io), admission_(new admission_control(limits)), data_(data)
 	{
-		boost::asio::ip::tcp::resolver resolver(acceptor_.get_io_service());
+		boost::asio::io_service resolver_io;
+		boost::asio::ip::tcp::resolver resolver(resolver_io);
 		boost::asio::ip::tcp::resolver::query query(host, service);
 		boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
 
-		acceptor_.open(endpoint.protocol());
-		acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-		acceptor_.bind(endpoint);
-		acceptor_.listen();
+#ifdef SO_REUSEPORT
+		if (mode == accept_mode::per_thread)
+		{
+			for (std::size_t i = 0; i < io.size(); ++i)
+				listeners_.emplace_back(new listener(io.get_io_service(i), true));
+		}
+#else
+		if (mode == accept_mode::per_thread)
+			LOG_WARNING("SO_REUSEPORT is not available, accepting on a single thread");
+#endif
+		if (listeners_.empty())
+			listeners_.emplace_back(new listener(io.get_io_service(), false));
+
+		for (auto& l : listeners_)
+		{
+			l->acceptor.open(endpoint.protocol());
+			l->acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+			if (l->pinned)
+				l->acceptor.set_option(reuse_port(true));
+#endif
+			l->acceptor.bind(endpoint);
+			l->acceptor.listen();
+		}
+
+		for (auto& l : listeners_)
+			start_accept(*l);
+	}
 
-		start_accept();
+	/**
+	 * Counters of the admitted and rejected connections
+	 */
+	admission_stats admission()
+	{
+		return admission_->stats();
 	}
 
 private:
 	typedef boost::shared_ptr<C> connection_ptr;
 
-	void start_accept()
+#ifdef SO_REUSEPORT
+	// SO_REUSEPORT as a SettableSocketOption, Asio has no public one
+	class reuse_port
 	{
-		connection_.reset(new C(io_pool_.get_io_service(), data_));
+	public:
+		explicit reuse_port(bool enable) : value_(enable ? 1 : 0)
+		{
+		}
+
+		template <typename Protocol>
+		int level(const Protocol&) const
+		{
+			return SOL_SOCKET;
+		}
+
+		template <typename Protocol>
+		int name(const Protocol&) const
+		{
+			return SO_REUSEPORT;
+		}
+
+		template <typename Protocol>
+		const int* data(const Protocol&) const
+		{
+			return &value_;
+		}
+
+		template <typename Protocol>
+		std::size_t size(const Protocol&) const
+		{
+			return sizeof(value_);
+		}
+
+	private:
+		int value_;
+	};
+#endif
 
-		acceptor_.async_accept(connection_->socket(),
-			boost::bind(&server::handle_accept, this,
-				boost::asio::placeholders::error));
+	// A listening socket. A pinned listener gives its connections to the
+	// io_service it runs on, otherwise they are spread over the pool.
+	struct listener
+	{
+		listener(boost::asio::io_service& io, bool pinned) :
+			io(io), acceptor(io), retry_timer(io), pinned(pinned)
+		{
+		}
+
+		boost::asio::io_service&       io;
+		boost::asio::ip::tcp::acceptor acceptor;
+		boost::asio::deadline_timer    retry_timer;
+		bool                           pinned;
+	};
+
+	void start_accept(listener& l)
+	{
+		// Only the single listener takes from the round robin, which is not
+		// thread safe
+		boost::asio::io_service& io = l.pinned ? l.io : io_pool_.get_io_service();
+
+		l.acceptor.async_accept(io,
+			[this, &l, &io](const boost::system::error_code& e, boost::asio::ip::tcp::socket socket)
+			{
+				handle_accept(l, e, io, std::move(socket));
+			});
 	}
 
-	void handle_accept(const boost::system::error_code& e)
+	void handle_accept(listener& l, const boost::system::error_code& e, boost::asio::io_service& io,
+		boost::asio::ip::tcp::socket socket)
 	{
+		if (e == boost::asio::error::operation_aborted)
+			return;
+
+		// Out of file descriptors or memory, accepting again right away would only
+		// repeat the error, so we give the connections we have time to close
+		if (e == boost::asio::error::no_descriptors || e == boost::asio::error::no_buffer_space ||
+			e == boost::asio::error::no_memory || e == boost::system::errc::too_many_files_open_in_system)
+		{
+			LOG_WARNING("accepting connections failed:", e.message());
+			l.retry_timer.expires_from_now(boost::posix_time::milliseconds(100));
+			l.retry_timer.async_wait(boost::bind(&server::start_accept, this, boost::ref(l)));
+			return;
+		}
+
 		if (!e)
-			connection_->start();
-		start_accept();
+			admit(io, std::move(socket));
+		start_accept(l);
+	}
+
+	void admit(boost::asio::io_service& io, boost::asio::ip::tcp::socket socket)
+	{
+		boost::system::error_code err;
+		boost::asio::ip::address address = socket.remote_endpoint(err).address();
+		// The peer is gone already
+		if (err)
+			return;
+
+		rejection reason;
+		if (!admission_->admit(address, reason))
+		{
+			LOG_DEBUG(log::dbg::connection, address.to_string(), "connection rejected:", to_string(reason));
+			socket.close(err);
+			return;
+		}
+
+		// Once the connection exists the slot is given back by whichever thread
+		// drops the last reference to it, which may be after the server is gone.
+		// Until then it's given back here if creating the connection fails.
+		C* created;
+		try
+		{
+			created = new C(io, data_);
+		}
+		catch (std::exception& e)
+		{
+			admission_->release(address);
+			LOG_ERROR(address.to_string(), "failed to create a connection:", e.what());
+			socket.close(err);
+			return;
+		}
+
+		boost::shared_ptr<admission_control> admission = admission_;
+		connection_ptr connection(created, [admission, address](C* c)
+			{
+				delete c;
+				admission->release(address);
+			});
+		connection->socket() = std::move(socket);
+		connection->start();
 	}
 
-	io_service_pool&               io_pool_;
-	boost::asio::ip::tcp::acceptor acceptor_;  
-	connection_ptr                 connection_;
-	D                              data_;
+	io_service_pool&                        io_pool_;
+	std::vector<std::unique_ptr<listener>>  listeners_;
+	boost::shared_ptr<admission_control>    admission_;
+	D                                       data_;
 };
 
 #endif // BARIUMSULFATE__SERVER__SERVER_HPP
@@ -0,0 +1,89 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+
+#include <protocol/packets.hpp>
+#include <server/status_cache.hpp>
+
+namespace
+{
+
+// A JSON string literal, quotes included
+std::string json_string(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+}
+
+status_cache::status_cache(const std::string& motd, size_t max_players) :
+    motd_{motd}, max_players_{max_players}, online_{0}, builds_{0}
+{
+}
+
+packet_ptr status_cache::response(size_t online)
+{
+    boost::mutex::scoped_lock lock{mutex_};
+    if (!response_ || online != online_)
+    {
+        online_ = online;
+        response_ = build(online);
+        builds_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return response_;
+}
+
+void status_cache::set_motd(const std::string& motd)
+{
+    boost::mutex::scoped_lock lock{mutex_};
+    motd_ = motd;
+    response_.reset();
+}
+
+packet_ptr status_cache::build(size_t online) const
+{
+    std::string json = "{\"description\":" + json_string(motd_) +
+        ",\"players\":{\"max\":" + std::to_string(max_players_) + ",\"online\":" + std::to_string(online) +
+        "},\"version\":{\"name\":\"1.8\",\"protocol\":47}}";
+    packet_ptr p = make_packet(packets::status::response{json});
+    p->frame();
+    return p;
+}
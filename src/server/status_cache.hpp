@@ -0,0 +1,65 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__SERVER__STATUS_CACHE_HPP
+#define BARIUMSULFATE__SERVER__STATUS_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <protocol/packet_pool.hpp>
+
+/**
+ * The status response of the server list ping, framed once and sent as is to
+ * every connection that asks, like a broadcast packet. It is rebuilt when the
+ * number of players online or the MOTD changed since the last one. Status
+ * connections never use compression, so the packet is framed without it.
+ *
+ * Thread safe, the io threads share one cache.
+ */
+class status_cache : private boost::noncopyable
+{
+public:
+    status_cache(const std::string& motd, size_t max_players);
+
+    // The response for the given number of players online
+    packet_ptr response(size_t online);
+
+    void set_motd(const std::string& motd);
+
+    // Number of times the response was built
+    uint64_t builds() const
+    {
+        return builds_.load(std::memory_order_relaxed);
+    }
+
+private:
+    packet_ptr build(size_t online) const;
+
+    boost::mutex mutex_;
+    std::string motd_;
+    size_t max_players_;
+    size_t online_;
+    packet_ptr response_;
+    std::atomic<uint64_t> builds_;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <world/chunk.hpp>
+
+namespace
+{
+
+// Bytes per section in the chunk data packet: blocks, block light, sky light
+constexpr size_t section_data_size = 2 * section::volume + 2 * nibble_array::bytes;
+
+}
+
+constexpr unsigned int chunk::section_count;
+constexpr uint8_t chunk::plains;
+
+chunk::chunk(int32_t x, int32_t z) :
+    x_{x}, z_{z}, version_{0}, sections_(), biomes_()
+{
+    biomes_.fill(plains);
+}
+
+uint16_t chunk::section_mask() const
+{
+    uint16_t mask = 0;
+    for (unsigned int i = 0; i < section_count; i++)
+        if (sections_[i] && sections_[i]->non_air())
+            mask |= static_cast<uint16_t>(1 << i);
+    return mask;
+}
+
+size_t chunk::data_size() const
+{
+    size_t sections = 0;
+    for (uint16_t mask = section_mask(); mask; mask &= static_cast<uint16_t>(mask - 1))
+        sections++;
+    return sections * section_data_size + biomes_.size();
+}
+
+void chunk::write_data(byte_stream& out) const
+{
+    uint16_t mask = section_mask();
+    size_t size = data_size();
+    uint8_t* data = out.append(size);
+
+    for (unsigned int i = 0; i < section_count; i++)
+    {
+        if (mask & (1 << i))
+        {
+            sections_[i]->write_blocks(data);
+            data += 2 * section::volume;
+        }
+    }
+    for (unsigned int i = 0; i < section_count; i++)
+    {
+        if (mask & (1 << i))
+        {
+            sections_[i]->write_block_light(data);
+            data += nibble_array::bytes;
+        }
+    }
+    for (unsigned int i = 0; i < section_count; i++)
+    {
+        if (mask & (1 << i))
+        {
+            sections_[i]->write_sky_light(data);
+            data += nibble_array::bytes;
+        }
+    }
+    std::copy(biomes_.begin(), biomes_.end(), data);
+}
+
+size_t chunk::memory_usage() const
+{
+    size_t bytes = sizeof(chunk);
+    for (auto& s : sections_)
+        if (s)
+            bytes += s->memory_usage();
+    return bytes;
+}
+
+void chunk::compact()
+{
+    for (auto& s : sections_)
+        if (s)
+            s->compact();
+}
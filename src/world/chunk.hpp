@@ -0,0 +1,154 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__CHUNK_HPP
+#define BARIUMSULFATE__WORLD__CHUNK_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include <protocol/byte_stream.hpp>
+#include <world/section.hpp>
+
+/**
+ * A chunk column of 16x256x16 blocks, made of 16 sections and a biome per block
+ * column. Coordinates are within the chunk (0-15, 0-255, 0-15).
+ *
+ * Sections that were never written to are not allocated, they are air with sky
+ * light 15 and no block light.
+ */
+class chunk : private boost::noncopyable
+{
+public:
+    static constexpr unsigned int section_count = 16;
+    static constexpr unsigned int height = section_count * 16;
+    static constexpr uint8_t plains = 1;
+
+    chunk(int32_t x, int32_t z);
+
+    int32_t x() const
+    {
+        return x_;
+    }
+
+    int32_t z() const
+    {
+        return z_;
+    }
+
+    uint16_t block(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        const section* s = sections_[y >> 4].get();
+        return s ? s->block(section::index(x, y & 0xF, z)) : air;
+    }
+
+    void set_block(unsigned int x, unsigned int y, unsigned int z, uint16_t state)
+    {
+        if (state == air && !sections_[y >> 4])
+            return;
+        version_++;
+        get_section(y).set_block(section::index(x, y & 0xF, z), state);
+    }
+
+    uint8_t block_light(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        const section* s = sections_[y >> 4].get();
+        return s ? s->block_light(section::index(x, y & 0xF, z)) : 0;
+    }
+
+    void set_block_light(unsigned int x, unsigned int y, unsigned int z, uint8_t value)
+    {
+        version_++;
+        get_section(y).set_block_light(section::index(x, y & 0xF, z), value);
+    }
+
+    uint8_t sky_light(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        const section* s = sections_[y >> 4].get();
+        return s ? s->sky_light(section::index(x, y & 0xF, z)) : 15;
+    }
+
+    void set_sky_light(unsigned int x, unsigned int y, unsigned int z, uint8_t value)
+    {
+        version_++;
+        get_section(y).set_sky_light(section::index(x, y & 0xF, z), value);
+    }
+
+    uint8_t biome(unsigned int x, unsigned int z) const
+    {
+        return biomes_[z << 4 | x];
+    }
+
+    void set_biome(unsigned int x, unsigned int z, uint8_t biome)
+    {
+        version_++;
+        biomes_[z << 4 | x] = biome;
+    }
+
+    // Changes with every write to the chunk, anything derived from the contents of
+    // the chunk (like its encoded packet) is stale once this changed
+    uint64_t version() const
+    {
+        return version_;
+    }
+
+    // The section at section height y (0-15), nullptr if it isn't allocated
+    const section* get_section_at(unsigned int y) const
+    {
+        return sections_[y].get();
+    }
+
+    // Bit n is set when section n has blocks other than air, the primary bit mask
+    // of the chunk data packet
+    uint16_t section_mask() const;
+
+    // Size of the data written by write_data
+    size_t data_size() const;
+
+    /**
+     * Writes the data field of a ground-up continuous protocol 47 chunk data packet
+     * for the overworld: the blocks of every section in section_mask(), their block
+     * light, their sky light and the biomes.
+     */
+    void write_data(byte_stream& out) const;
+
+    // Memory used by the chunk and its sections
+    size_t memory_usage() const;
+
+    // Calls compact() on every section
+    void compact();
+
+private:
+    section& get_section(unsigned int y)
+    {
+        std::unique_ptr<section>& s = sections_[y >> 4];
+        if (!s)
+            s.reset(new section{});
+        return *s;
+    }
+
+    int32_t x_;
+    int32_t z_;
+    uint64_t version_;
+    std::array<std::unique_ptr<section>, section_count> sections_;
+    std::array<uint8_t, 256> biomes_;
+};
+
+#endif
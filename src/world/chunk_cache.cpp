@@ -0,0 +1,197 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <stdexcept>
+
+#include <protocol/packets.hpp>
+#include <world/chunk_cache.hpp>
+
+constexpr size_t chunk_cache::max_bulk_chunks;
+
+namespace
+{
+
+int64_t chunk_key(int32_t x, int32_t z)
+{
+    return static_cast<int64_t>(x) << 32 | static_cast<uint32_t>(z);
+}
+
+}
+
+chunk_cache::chunk_cache(const compression_config& compression /* = compression_config::disabled() */) :
+    compression_(compression), stats_()
+{
+}
+
+void chunk_cache::prepare(const std::vector<const chunk*>& chunks, task_pool& pool)
+{
+    std::vector<std::pair<entry*, const chunk*>> work;
+    for (const chunk* c : chunks)
+    {
+        entry& e = entries_[chunk_key(c->x(), c->z())];
+        if (e.prepared || !stale(e, *c))
+            continue;
+        // A chunk may be in the list more than once
+        e.prepared = true;
+        work.emplace_back(&e, c);
+    }
+
+    pool.parallel_for(work.size(), [this, &work](size_t i)
+    {
+        encode(*work[i].first, *work[i].second);
+    });
+}
+
+packet_ptr chunk_cache::chunk_data(const chunk& c)
+{
+    return get(c).packet;
+}
+
+packet_ptr chunk_cache::map_chunk_bulk(const chunk* const* begin, const chunk* const* end)
+{
+    size_t count = static_cast<size_t>(end - begin);
+    if (count > max_bulk_chunks)
+        throw std::runtime_error("Too many chunks for a map chunk bulk packet.");
+
+    std::vector<const entry*> entries;
+    entries.reserve(count);
+    size_t size = 0;
+    for (auto it = begin; it != end; ++it)
+    {
+        entries.push_back(&get(**it));
+        size += entries.back()->data_size;
+    }
+
+    bool compress = compression_.enabled();
+    packet_ptr p = packet_pool::acquire(compress ? 0 : size + count * 10 + 8);
+    *p << varint<unsigned int>(packets::play::map_chunk_bulk::id)
+        << true                                 // sky light sent
+        << varint<size_t>(count);
+    for (size_t i = 0; i < count; i++)
+        *p << begin[i]->x() << begin[i]->z() << entries[i]->mask;
+
+    size_t total = p->size() + size;
+    if (compress && total >= static_cast<size_t>(compression_.threshold))
+    {
+        // Only the header is compressed here, the packet keeps just the header
+        std::vector<uint8_t> body;
+        zlib_builder builder{body};
+        builder.raw(&p->data()[0], p->size());
+        for (const entry* e : entries)
+            builder.segment(e->segment);
+        builder.finish();
+        p->frame_precompressed(std::move(body), total);
+        return p;
+    }
+
+    for (const entry* e : entries)
+    {
+        if (compress)
+        {
+            // Below a (very high) threshold, the cache only has the compressed data
+            std::vector<uint8_t> stream;
+            zlib_builder builder{stream};
+            builder.segment(e->segment);
+            builder.finish();
+            decompress(stream.data(), stream.size(), p->append(e->data_size), e->data_size);
+        }
+        else
+        {
+            const uint8_t* data = &e->packet->data()[e->data_offset];
+            std::copy(data, data + e->data_size, p->append(e->data_size));
+        }
+    }
+    if (compress)
+        p->frame_compressed(compression_.threshold, compression_.level);
+    else
+        p->frame();
+    return p;
+}
+
+void chunk_cache::erase(int32_t x, int32_t z)
+{
+    entries_.erase(chunk_key(x, z));
+}
+
+const chunk_cache::entry& chunk_cache::get(const chunk& c)
+{
+    entry& e = entries_[chunk_key(c.x(), c.z())];
+    if (stale(e, c))
+    {
+        encode(e, c);
+    }
+    else if (!e.prepared)
+    {
+        stats_.hits++;
+        stats_.bytes_saved += e.data_size;
+        return e;
+    }
+
+    e.prepared = false;
+    stats_.misses++;
+    stats_.bytes_encoded += e.data_size;
+    return e;
+}
+
+// Only touches e, prepare() runs this for several entries at once
+void chunk_cache::encode(entry& e, const chunk& c) const
+{
+    e.version = c.version();
+    e.mask = c.section_mask();
+    e.data_size = c.data_size();
+
+    bool compress = compression_.enabled();
+    packet_ptr p = packet_pool::acquire(compress ? 0 : e.data_size + 16);
+    *p << varint<unsigned int>(packets::play::chunk_data::id)
+        << c.x() << c.z()
+        << true                                 // ground-up continuous
+        << e.mask
+        << varint<size_t>(e.data_size);
+    e.data_offset = p->pos();
+
+    if (!compress)
+    {
+        c.write_data(*p);
+        p->frame();
+        e.packet = p;
+        return;
+    }
+
+    static thread_local byte_stream data;
+    data.clear();
+    c.write_data(data);
+    e.segment = compress_segment(&data.data()[0], data.size(), compression_.level);
+
+    size_t total = p->size() + e.data_size;
+    if (total < static_cast<size_t>(compression_.threshold))
+    {
+        const uint8_t* begin = &data.data()[0];
+        std::copy(begin, begin + data.size(), p->append(data.size()));
+        p->frame_compressed(compression_.threshold, compression_.level);
+    }
+    else
+    {
+        std::vector<uint8_t> body;
+        zlib_builder builder{body};
+        builder.raw(&p->data()[0], p->size());
+        builder.segment(e.segment);
+        builder.finish();
+        p->frame_precompressed(std::move(body), total);
+    }
+    e.packet = p;
+}
@@ -0,0 +1,124 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__CHUNK_CACHE_HPP
+#define BARIUMSULFATE__WORLD__CHUNK_CACHE_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <misc/task_pool.hpp>
+#include <protocol/compression.hpp>
+#include <protocol/packet_pool.hpp>
+#include <world/chunk.hpp>
+
+struct chunk_cache_stats
+{
+    uint64_t hits;           // chunks whose cached data was used
+    uint64_t misses;         // chunks that had to be encoded
+    uint64_t bytes_saved;    // chunk data reused instead of encoded again
+    uint64_t bytes_encoded;  // chunk data encoded
+
+    double hit_rate() const
+    {
+        return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0;
+    }
+};
+
+/**
+ * Keeps the framed chunk data packet (0x21) of every chunk that was sent, so a
+ * chunk is encoded once per version instead of once per player. A cached packet
+ * is used as long as the version of its chunk didn't change, a block change only
+ * invalidates the chunk it happened in.
+ *
+ * Map chunk bulk packets (0x26) are put together from the data of the cached
+ * packets, the chunks in it are not encoded again either.
+ *
+ * With compression the cache keeps the compressed chunk data instead, as a
+ * deflate segment that can be spliced into the zlib stream of any packet. A chunk
+ * is compressed once per version, chunk data and map chunk bulk packets only
+ * compress their few bytes of header. The packets are framed for connections with
+ * compression then.
+ *
+ * Not thread safe, the world tick owns the cache. prepare() spreads the encoding
+ * over a task_pool.
+ */
+class chunk_cache : private boost::noncopyable
+{
+public:
+    // Most chunks in one map chunk bulk packet, a bulk of full columns stays well
+    // below the 2 MiB the client accepts
+    static constexpr size_t max_bulk_chunks = 10;
+
+    explicit chunk_cache(const compression_config& compression = compression_config::disabled());
+
+    // Encodes the chunks whose packets are missing or stale on the threads of pool,
+    // so the packets of a batch of chunks don't have to be encoded one by one
+    void prepare(const std::vector<const chunk*>& chunks, task_pool& pool);
+
+    // The framed chunk data packet of c
+    packet_ptr chunk_data(const chunk& c);
+
+    // A framed map chunk bulk packet of the chunks in [begin, end), at most
+    // max_bulk_chunks of them
+    packet_ptr map_chunk_bulk(const chunk* const* begin, const chunk* const* end);
+
+    // Drops the packet of the chunk at x, z. Has to be called when that chunk is
+    // unloaded, a new chunk at the same spot starts over at version 0.
+    void erase(int32_t x, int32_t z);
+
+    size_t size() const
+    {
+        return entries_.size();
+    }
+
+    const chunk_cache_stats& stats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct entry
+    {
+        uint64_t version;
+        // Encoded by prepare() and not used yet, the first use is a miss
+        bool prepared;
+        uint16_t mask;
+        // Where the chunk data is in the packet, without compression
+        size_t data_offset;
+        size_t data_size;
+        packet_ptr packet;
+        // The compressed chunk data, with compression
+        deflate_segment segment;
+    };
+
+    const entry& get(const chunk& c);
+    bool stale(const entry& e, const chunk& c) const
+    {
+        return !e.packet || e.version != c.version();
+    }
+    void encode(entry& e, const chunk& c) const;
+
+    compression_config compression_;
+    std::unordered_map<int64_t, entry> entries_;
+    chunk_cache_stats stats_;
+};
+
+#endif
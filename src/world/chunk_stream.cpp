@@ -0,0 +1,95 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdlib>
+
+#include <world/chunk_stream.hpp>
+
+chunk_stream::chunk_stream(int32_t view_distance) :
+    view_distance_{view_distance}, centered_{false}, x_{0}, z_{0}, sent_{0}, unloaded_{0}
+{
+    // Walk a square spiral outwards: 1 step right, 1 down, 2 left, 2 up, 3 right...
+    size_t side = static_cast<size_t>(2 * view_distance + 1);
+    int32_t x = 0, z = 0, dx = 1, dz = 0;
+    int32_t steps = 1;
+    spiral_.emplace_back(0, 0);
+    while (spiral_.size() < side * side)
+    {
+        for (int turn = 0; turn < 2; turn++)
+        {
+            for (int32_t i = 0; i < steps && spiral_.size() < side * side; i++)
+            {
+                x += dx;
+                z += dz;
+                spiral_.emplace_back(x, z);
+            }
+            std::swap(dx, dz);
+            dx = -dx;
+        }
+        steps++;
+    }
+}
+
+bool chunk_stream::move_to(int32_t x, int32_t z, std::vector<position>& unload)
+{
+    if (centered_ && x == x_ && z == z_)
+        return false;
+    centered_ = true;
+    x_ = x;
+    z_ = z;
+
+    for (auto it = loaded_.begin(); it != loaded_.end(); )
+    {
+        int32_t cx = static_cast<int32_t>(*it >> 32);
+        int32_t cz = static_cast<int32_t>(*it & 0xFFFFFFFF);
+        if (in_range(cx, cz))
+        {
+            ++it;
+            continue;
+        }
+        unload.emplace_back(cx, cz);
+        it = loaded_.erase(it);
+        unloaded_++;
+    }
+
+    // Chunks that were queued for the old center and are still missing are queued
+    // again in the right order
+    queue_.clear();
+    for (const position& offset : spiral_)
+    {
+        position p{x + offset.first, z + offset.second};
+        if (!loaded_.count(key(p.first, p.second)))
+            queue_.push_back(p);
+    }
+    return true;
+}
+
+bool chunk_stream::next(position& chunk)
+{
+    if (queue_.empty())
+        return false;
+    chunk = queue_.front();
+    queue_.pop_front();
+    loaded_.insert(key(chunk.first, chunk.second));
+    sent_++;
+    return true;
+}
+
+bool chunk_stream::in_range(int32_t x, int32_t z) const
+{
+    return std::abs(x - x_) <= view_distance_ + 1 && std::abs(z - z_) <= view_distance_ + 1;
+}
@@ -0,0 +1,104 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__CHUNK_STREAM_HPP
+#define BARIUMSULFATE__WORLD__CHUNK_STREAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+struct chunk_stream_stats
+{
+    size_t queued;      // chunks waiting to be sent
+    size_t loaded;      // chunks the client has
+    uint64_t sent;      // chunks sent so far
+    uint64_t unloaded;  // chunks unloaded so far
+};
+
+/**
+ * Decides which chunks a player gets and in what order. The chunks within
+ * view_distance of the chunk the player is in are queued nearest first, in a
+ * spiral around the player. The world takes a few of them off the queue every
+ * tick, as many as the connection can take.
+ *
+ * Chunks are unloaded lazily: only once the player is more than view_distance + 1
+ * chunks away from them, so walking back and forth over a chunk border doesn't
+ * unload and resend a row of chunks every time.
+ *
+ * Only the world tick touches a chunk_stream.
+ */
+class chunk_stream
+{
+public:
+    typedef std::pair<int32_t, int32_t> position;
+
+    explicit chunk_stream(int32_t view_distance);
+
+    /**
+     * Moves the center of the view to chunk x, z and queues the chunks around it
+     * the client doesn't have yet. Does nothing if the center didn't change.
+     *
+     * \param[out] unload The loaded chunks that are now out of range, the client
+     *                    has to be told to unload them.
+     * \return true if the center changed
+     */
+    bool move_to(int32_t x, int32_t z, std::vector<position>& unload);
+
+    // Takes the next chunk to send off the queue and counts it as loaded
+    bool next(position& chunk);
+
+    // true if the player is close enough to chunk x, z to have or get it
+    bool in_range(int32_t x, int32_t z) const;
+
+    template <typename F>
+    void for_each_in_range(F f) const
+    {
+        int32_t range = view_distance_ + 1;
+        for (int32_t z = z_ - range; z <= z_ + range; z++)
+            for (int32_t x = x_ - range; x <= x_ + range; x++)
+                f(x, z);
+    }
+
+    chunk_stream_stats stats() const
+    {
+        return chunk_stream_stats{queue_.size(), loaded_.size(), sent_, unloaded_};
+    }
+
+private:
+    static int64_t key(int32_t x, int32_t z)
+    {
+        return static_cast<int64_t>(x) << 32 | static_cast<uint32_t>(z);
+    }
+
+    int32_t view_distance_;
+    // Offsets from the center, nearest first
+    std::vector<position> spiral_;
+
+    bool centered_;
+    int32_t x_;
+    int32_t z_;
+    std::deque<position> queue_;
+    std::unordered_set<int64_t> loaded_;
+    uint64_t sent_;
+    uint64_t unloaded_;
+};
+
+#endif
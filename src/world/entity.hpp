@@ -0,0 +1,46 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__ENTITY_HPP
+#define BARIUMSULFATE__WORLD__ENTITY_HPP
+
+#include <cstdint>
+
+// The part of an entity the world tick simulates. Positions are in blocks,
+// velocities in blocks per tick.
+struct entity
+{
+    int32_t id;
+    double x;
+    double y;
+    double z;
+    double vx;
+    double vz;
+    float yaw;
+    float pitch;
+    bool on_ground;
+    // Set when the entity moved during the current tick, the broadcast phase tells
+    // the other players about it and clears it.
+    bool moved;
+    // The position of a controlled entity (a player) comes from its client, the
+    // simulation doesn't move it.
+    bool controlled;
+    // Key of the region the world keeps the entity in, owned by the world
+    int64_t region;
+};
+
+#endif
@@ -0,0 +1,37 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <world/generator.hpp>
+
+void generate_flat(chunk& c)
+{
+    const uint16_t layers[] = {block_state(7), block_state(3), block_state(3), block_state(2)};
+    constexpr unsigned int ground = sizeof(layers) / sizeof(layers[0]);
+
+    for (unsigned int y = 0; y < ground; y++)
+    {
+        for (unsigned int z = 0; z < 16; z++)
+        {
+            for (unsigned int x = 0; x < 16; x++)
+            {
+                c.set_block(x, y, z, layers[y]);
+                // The sky doesn't reach into the ground
+                c.set_sky_light(x, y, z, 0);
+            }
+        }
+    }
+}
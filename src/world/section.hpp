@@ -0,0 +1,320 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__SECTION_HPP
+#define BARIUMSULFATE__WORLD__SECTION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <protocol/endian.hpp>
+
+// Block states are the protocol 47 ids: block id << 4 | metadata
+constexpr uint16_t block_state(uint16_t id, uint8_t meta = 0)
+{
+    return static_cast<uint16_t>(id << 4 | (meta & 0xF));
+}
+
+constexpr uint16_t air = 0;
+
+// 4096 light values of 4 bits. As long as all of them are the same only that
+// value is stored, the 2048 bytes are allocated on the first write of another
+// value. Nibbles are in protocol order, the even index in the low nibble.
+class nibble_array
+{
+public:
+    static constexpr size_t bytes = 2048;
+
+    explicit nibble_array(uint8_t fill) : fill_{fill}
+    {
+    }
+
+    uint8_t get(size_t i) const
+    {
+        if (!data_)
+            return fill_;
+        return (data_[i >> 1] >> ((i & 1) << 2)) & 0xF;
+    }
+
+    void set(size_t i, uint8_t value)
+    {
+        if (!data_)
+        {
+            if (value == fill_)
+                return;
+            data_.reset(new uint8_t[bytes]);
+            std::memset(data_.get(), fill_ | fill_ << 4, bytes);
+        }
+        uint8_t& byte = data_[i >> 1];
+        int shift = (i & 1) << 2;
+        byte = static_cast<uint8_t>((byte & ~(0xF << shift)) | (value & 0xF) << shift);
+    }
+
+    // Writes the 2048 bytes of the array in protocol order
+    void write(uint8_t* out) const
+    {
+        if (data_)
+            std::memcpy(out, data_.get(), bytes);
+        else
+            std::memset(out, fill_ | fill_ << 4, bytes);
+    }
+
+    // Heap memory used by the array
+    size_t memory_usage() const
+    {
+        return data_ ? bytes : 0;
+    }
+
+private:
+    uint8_t fill_;
+    std::unique_ptr<uint8_t[]> data_;
+};
+
+/**
+ * 16x16x16 blocks with their light. Blocks are stored as indices into a palette
+ * of the block states used in the section, bit-packed into 64 bit words.
+ *
+ * Indices are 0, 1, 2, 4 or 8 bits wide, so an index never straddles two words
+ * and a lookup is a shift and a mask. A section with a single block state has no
+ * index array at all. Once a section needs more than 256 states the palette is
+ * dropped and the block states are stored directly in 16 bits.
+ *
+ * The palette only grows, states that are no longer used keep their entry until
+ * compact() is called.
+ */
+class section
+{
+public:
+    static constexpr size_t volume = 4096;
+    static constexpr unsigned int direct_bits = 16;
+
+    // Index of a block in a section and in the protocol arrays, coordinates are
+    // within the section
+    static size_t index(unsigned int x, unsigned int y, unsigned int z)
+    {
+        return y << 8 | z << 4 | x;
+    }
+
+    explicit section(uint8_t sky_light = 15) :
+        bits_{0}, per_word_shift_{0}, non_air_{0}, palette_(1, air), block_light_{0}, sky_light_{sky_light}
+    {
+    }
+
+    uint16_t block(size_t i) const
+    {
+        if (bits_ == 0)
+            return palette_[0];
+        uint16_t value = read(i);
+        return bits_ == direct_bits ? value : palette_[value];
+    }
+
+    void set_block(size_t i, uint16_t state)
+    {
+        uint16_t old = block(i);
+        if (old == state)
+            return;
+
+        if (old == air)
+            non_air_++;
+        else if (state == air)
+            non_air_--;
+        write(i, palette_index(state));
+    }
+
+    uint8_t block_light(size_t i) const
+    {
+        return block_light_.get(i);
+    }
+
+    void set_block_light(size_t i, uint8_t value)
+    {
+        block_light_.set(i, value);
+    }
+
+    uint8_t sky_light(size_t i) const
+    {
+        return sky_light_.get(i);
+    }
+
+    void set_sky_light(size_t i, uint8_t value)
+    {
+        sky_light_.set(i, value);
+    }
+
+    // Number of blocks that aren't air, sections without any are not sent
+    size_t non_air() const
+    {
+        return non_air_;
+    }
+
+    // Bits per block, 0 for a section of a single state
+    unsigned int bits() const
+    {
+        return bits_;
+    }
+
+    size_t palette_size() const
+    {
+        return palette_.size();
+    }
+
+    // Writes the 4096 block states as little endian 16 bit values, the protocol 47
+    // layout
+    void write_blocks(uint8_t* out) const
+    {
+        uint16_t states[volume];
+        if (bits_ == 0)
+        {
+            std::fill(states, states + volume, palette_[0]);
+        }
+        else if (bits_ == direct_bits)
+        {
+            // The words hold the states in order, 4 per word from the low bits up
+            for (size_t w = 0; w < data_.size(); w++)
+                for (size_t k = 0; k < 4; k++)
+                    states[w * 4 + k] = static_cast<uint16_t>(data_[w] >> (16 * k));
+        }
+        else
+        {
+            // A word at a time, the palette lookups don't depend on each other
+            size_t per_word = size_t{1} << per_word_shift_;
+            uint64_t mask = (uint64_t{1} << bits_) - 1;
+            uint16_t* state = states;
+            for (uint64_t word : data_)
+            {
+                for (size_t k = 0; k < per_word; k++, word >>= bits_)
+                    *state++ = palette_[word & mask];
+            }
+        }
+        endian::store_le(out, states, volume);
+    }
+
+    void write_block_light(uint8_t* out) const
+    {
+        block_light_.write(out);
+    }
+
+    void write_sky_light(uint8_t* out) const
+    {
+        sky_light_.write(out);
+    }
+
+    // Drops the palette entries that are no longer used and packs the indices as
+    // tight as the remaining palette allows
+    void compact()
+    {
+        std::vector<uint16_t> states(volume);
+        for (size_t i = 0; i < volume; i++)
+            states[i] = block(i);
+
+        std::vector<uint16_t> used{states};
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+
+        bits_ = 0;
+        palette_.assign(1, used[0]);
+        data_.clear();
+        data_.shrink_to_fit();
+        for (size_t i = 0; i < volume; i++)
+            if (states[i] != palette_[0])
+                write(i, palette_index(states[i]));
+    }
+
+    // Heap and object memory used by the section
+    size_t memory_usage() const
+    {
+        return sizeof(section) + palette_.capacity() * sizeof(uint16_t) + data_.capacity() * sizeof(uint64_t) +
+            block_light_.memory_usage() + sky_light_.memory_usage();
+    }
+
+private:
+    uint16_t read(size_t i) const
+    {
+        uint64_t word = data_[i >> per_word_shift_];
+        unsigned int shift = static_cast<unsigned int>(i & ((size_t{1} << per_word_shift_) - 1)) * bits_;
+        return static_cast<uint16_t>((word >> shift) & ((uint64_t{1} << bits_) - 1));
+    }
+
+    void write(size_t i, uint16_t value)
+    {
+        uint64_t& word = data_[i >> per_word_shift_];
+        unsigned int shift = static_cast<unsigned int>(i & ((size_t{1} << per_word_shift_) - 1)) * bits_;
+        uint64_t mask = ((uint64_t{1} << bits_) - 1) << shift;
+        word = (word & ~mask) | (static_cast<uint64_t>(value) << shift);
+    }
+
+    // The value to store for state, adds it to the palette if needed
+    uint16_t palette_index(uint16_t state)
+    {
+        if (bits_ == direct_bits)
+            return state;
+
+        auto it = std::find(palette_.begin(), palette_.end(), state);
+        if (it != palette_.end())
+            return static_cast<uint16_t>(it - palette_.begin());
+
+        if (palette_.size() == size_t{1} << bits_)
+        {
+            grow();
+            if (bits_ == direct_bits)
+                return state;
+        }
+        palette_.push_back(state);
+        return static_cast<uint16_t>(palette_.size() - 1);
+    }
+
+    // Doubles the width of the indices, or switches to direct storage
+    void grow()
+    {
+        std::vector<uint16_t> values(volume);
+        for (size_t i = 0; i < volume; i++)
+            values[i] = bits_ ? read(i) : 0;
+
+        unsigned int bits = bits_ ? bits_ * 2 : 1;
+        bool direct = bits > 8;
+        if (direct)
+        {
+            bits = direct_bits;
+            for (auto& v : values)
+                v = palette_[v];
+            palette_.clear();
+            palette_.shrink_to_fit();
+        }
+
+        bits_ = bits;
+        per_word_shift_ = 0;
+        while ((bits << per_word_shift_) < 64)
+            per_word_shift_++;
+        data_.assign(volume >> per_word_shift_, 0);
+        for (size_t i = 0; i < volume; i++)
+            write(i, values[i]);
+    }
+
+    unsigned int bits_;
+    // log2 of the number of indices in a word
+    unsigned int per_word_shift_;
+    size_t non_air_;
+    std::vector<uint16_t> palette_;
+    std::vector<uint64_t> data_;
+    nibble_array block_light_;
+    nibble_array sky_light_;
+};
+
+#endif
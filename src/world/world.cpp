@@ -0,0 +1,574 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include <connection/broadcast.hpp>
+#include <connection/client.hpp>
+#include <connection/connection.hpp>
+#include <misc/log.hpp>
+#include <protocol/packet_pool.hpp>
+#include <protocol/packets.hpp>
+#include <world/generator.hpp>
+#include <world/world.hpp>
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr std::chrono::milliseconds world::tick_length;
+constexpr uint64_t world::max_catchup_ticks;
+constexpr double world::interaction_range;
+constexpr int32_t world::view_distance;
+constexpr size_t world::max_chunks_per_tick;
+constexpr size_t world::max_pending_chunk_bytes;
+constexpr uint64_t world::chunk_unload_interval;
+constexpr size_t world::max_players;
+
+namespace
+{
+
+// Ticks between keep alive packets, the client gives up after 20 seconds without one
+constexpr uint64_t keep_alive_interval = 200;
+
+int32_t region_x(int64_t key)
+{
+    return static_cast<int32_t>(key >> 32);
+}
+
+int32_t region_z(int64_t key)
+{
+    return static_cast<int32_t>(key & 0xFFFFFFFF);
+}
+
+int64_t pack_key(int32_t x, int32_t z)
+{
+    return static_cast<int64_t>(x) << 32 | static_cast<uint32_t>(z);
+}
+
+template <typename T>
+void erase_value(std::vector<T>& v, T value)
+{
+    v.erase(std::find(v.begin(), v.end(), value));
+}
+
+uint64_t elapsed_us(clock_type::time_point from, clock_type::time_point to)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+}
+
+// Angles are sent as steps of 1/256 of a full turn
+uint8_t angle(float degrees)
+{
+    return static_cast<uint8_t>(static_cast<int>(degrees * 256.0f / 360.0f));
+}
+
+}
+
+world::world(size_t threads /* = 1 */, const compression_config& compression /* = compression_config::disabled() */,
+    authenticator* auth /* = nullptr */) :
+    running_{false}, timings_(), pool_{threads}, compression_{compression}, compression_pool_{compression.threads},
+    authenticator_{auth}, status_{"Bariumsulfate", max_players},
+    chunk_cache_{compression}, tick_{0}, overruns_{0}, skipped_{0},
+    next_entity_id_{1}, player_count_{0}
+{
+}
+
+world::~world()
+{
+    stop();
+}
+
+void world::start()
+{
+    running_ = true;
+    thread_ = boost::thread{boost::bind(&world::run, this)};
+}
+
+void world::stop()
+{
+    running_ = false;
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void world::add_client(client* c)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    joining_.push_back(c);
+}
+
+void world::add_entity(const entity& e)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    spawning_.push_back(e);
+}
+
+int64_t world::region_key(double x, double z)
+{
+    return pack_key(static_cast<int32_t>(std::floor(x)) >> region_shift,
+        static_cast<int32_t>(std::floor(z)) >> region_shift);
+}
+
+tick_timings world::timings()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return timings_;
+}
+
+void world::run()
+{
+    auto next = clock_type::now();
+    while (running_)
+    {
+        auto now = clock_type::now();
+        if (now < next)
+        {
+            std::this_thread::sleep_until(next);
+            continue;
+        }
+
+        // Ticks that should have happened by now are caught up back to back, but
+        // we don't try to catch up on more than max_catchup_ticks
+        uint64_t behind = static_cast<uint64_t>((now - next) / tick_length);
+        if (behind > max_catchup_ticks)
+        {
+            uint64_t skip = behind - max_catchup_ticks;
+            LOG_WARNING("world tick is", behind, "ticks behind, skipping", skip, "ticks");
+            skipped_ += skip;
+            next += skip * tick_length;
+        }
+
+        tick();
+        next += tick_length;
+    }
+}
+
+void world::tick()
+{
+    tick_timings t = tick_timings();
+
+    auto start = clock_type::now();
+    join();
+    remove_closed_clients();
+    sort_regions();
+    drain_packets();
+    auto drained = clock_type::now();
+    simulate(t);
+    auto simulated = clock_type::now();
+    stream_chunks(t);
+    auto streamed = clock_type::now();
+    broadcast();
+    auto end = clock_type::now();
+
+    t.tick = tick_;
+    t.drain = elapsed_us(start, drained);
+    t.simulate = elapsed_us(drained, simulated);
+    t.stream = elapsed_us(simulated, streamed);
+    t.broadcast = elapsed_us(streamed, end);
+    t.total = elapsed_us(start, end);
+
+    if (end - start > tick_length)
+    {
+        overruns_++;
+        LOG_WARNING("world tick", tick_, "took", t.total, "us, drain", t.drain,
+            "us, simulate", t.simulate, "us, stream", t.stream, "us, broadcast", t.broadcast, "us");
+    }
+    t.overruns = overruns_;
+    t.skipped = skipped_;
+    t.chunks = chunk_cache_.stats();
+
+    if (tick_ % 20 == 0)
+        LOG_DEBUG(log::dbg::world, "tick", tick_, "players", clients_.size(), "regions", t.regions,
+            "border entities", t.border_entities, "loaded chunks", t.loaded_chunks, "queued chunks",
+            t.chunks_queued, "max queue", t.max_chunk_queue, "chunk cache hit rate", t.chunks.hit_rate(),
+            "drain", t.drain, "us, simulate", t.simulate, "us, stream", t.stream, "us, broadcast", t.broadcast,
+            "us");
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        timings_ = t;
+    }
+    tick_++;
+}
+
+void world::join()
+{
+    std::vector<client*> clients;
+    std::vector<entity> entities;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        std::swap(clients, joining_);
+        std::swap(entities, spawning_);
+    }
+
+    for (client* c : clients)
+    {
+        entity& e = c->player();
+        e.region = region_key(e.x, e.z);
+        region& r = regions_[e.region];
+        r.clients.push_back(c);
+        r.entities.push_back(&e);
+        clients_.push_back(c);
+    }
+
+    for (const entity& spawned : entities)
+    {
+        entities_.push_back(spawned);
+        entity& e = entities_.back();
+        e.region = region_key(e.x, e.z);
+        regions_[e.region].entities.push_back(&e);
+    }
+}
+
+// Removes the clients whose connection is gone from the world
+void world::remove_closed_clients()
+{
+    auto closed = std::partition(clients_.begin(), clients_.end(),
+        [](client* c) { return !c->get_connection()->closed(); });
+    for (auto it = closed; it != clients_.end(); ++it)
+    {
+        entity& e = (*it)->player();
+        region& r = regions_[e.region];
+        erase_value(r.clients, *it);
+        erase_value(r.entities, &e);
+        if (r.entities.empty())
+            regions_.erase(e.region);
+
+        // This may destroy the connection and the client with it
+        boost::shared_ptr<connection> con = (*it)->leave_world();
+        LOG_DEBUG(log::dbg::world, con->address(), "left the world");
+    }
+    clients_.erase(closed, clients_.end());
+    player_count_.store(clients_.size(), std::memory_order_relaxed);
+}
+
+void world::sort_regions()
+{
+    sorted_regions_.clear();
+    for (auto& r : regions_)
+        sorted_regions_.emplace_back(r.first, &r.second);
+    std::sort(sorted_regions_.begin(), sorted_regions_.end(),
+        [](const std::pair<int64_t, region*>& a, const std::pair<int64_t, region*>& b)
+        { return a.first < b.first; });
+}
+
+// Handles the packets the clients sent since the last tick, every region on its own
+void world::drain_packets()
+{
+    pool_.parallel_for(sorted_regions_.size(), [this](size_t i)
+    {
+        for (client* c : sorted_regions_[i].second->clients)
+            c->handle_delayed_packets(max_packets_per_tick);
+    });
+}
+
+void world::simulate(tick_timings& t)
+{
+    pool_.parallel_for(sorted_regions_.size(), [this](size_t i)
+    {
+        simulate_region(*sorted_regions_[i].second);
+    });
+
+    t.regions = sorted_regions_.size();
+    t.border_entities = resolve_borders();
+    t.handoffs = hand_off();
+}
+
+// Moves the entities that move on their own and pushes apart entities that are
+// too close to each other. Only touches the entities in the region.
+void world::simulate_region(region& r)
+{
+    for (entity* e : r.entities)
+    {
+        if (!e->controlled && (e->vx != 0 || e->vz != 0))
+        {
+            e->x += e->vx;
+            e->z += e->vz;
+            e->moved = true;
+        }
+    }
+
+    std::vector<entity*> entities{r.entities};
+    collide(entities, false);
+}
+
+// Pushes apart the entities of different regions that got too close to each
+// other. Only entities near the border of their region can be involved, so
+// regions without any are left alone. Runs on the tick thread after all regions
+// are simulated.
+uint64_t world::resolve_borders()
+{
+    std::vector<entity*> border;
+    for (auto& r : sorted_regions_)
+    {
+        double min_x = static_cast<double>(region_x(r.first)) * region_size;
+        double min_z = static_cast<double>(region_z(r.first)) * region_size;
+        for (entity* e : r.second->entities)
+        {
+            // Entities that left the region during the simulation are included too
+            if (e->x - min_x < interaction_range || min_x + region_size - e->x < interaction_range ||
+                e->z - min_z < interaction_range || min_z + region_size - e->z < interaction_range)
+                border.push_back(e);
+        }
+    }
+
+    collide(border, true);
+    return border.size();
+}
+
+// Sort and sweep along the x axis. The order only depends on the positions and
+// ids of the entities, so the result is the same no matter which thread runs it.
+void world::collide(std::vector<entity*>& entities, bool cross_region_only)
+{
+    std::sort(entities.begin(), entities.end(), [](const entity* a, const entity* b)
+    {
+        return a->x < b->x || (a->x == b->x && a->id < b->id);
+    });
+
+    for (size_t i = 0; i < entities.size(); i++)
+    {
+        entity* a = entities[i];
+        for (size_t j = i + 1; j < entities.size() && entities[j]->x - a->x < interaction_range; j++)
+        {
+            entity* b = entities[j];
+            if (cross_region_only && a->region == b->region)
+                continue;
+
+            double dx = b->x - a->x;
+            double dz = b->z - a->z;
+            double distance = std::sqrt(dx * dx + dz * dz);
+            if (distance >= interaction_range || std::abs(b->y - a->y) >= 2.0)
+                continue;
+
+            // Entities on the exact same spot are pushed apart along the x axis
+            if (distance == 0)
+            {
+                dx = 1;
+                distance = 1;
+            }
+            double push = (interaction_range - distance) / 2 / distance;
+            if (!a->controlled)
+            {
+                a->x -= dx * push;
+                a->z -= dz * push;
+                a->moved = true;
+            }
+            if (!b->controlled)
+            {
+                b->x += dx * push;
+                b->z += dz * push;
+                b->moved = true;
+            }
+        }
+    }
+}
+
+// Moves the entities that left their region to their new region, in order of
+// entity id.
+uint64_t world::hand_off()
+{
+    struct move
+    {
+        entity* e;
+        client* c;
+        int64_t to;
+    };
+
+    std::vector<move> moves;
+    for (auto& r : sorted_regions_)
+    {
+        for (client* c : r.second->clients)
+        {
+            entity& e = c->player();
+            int64_t key = region_key(e.x, e.z);
+            if (key != e.region)
+                moves.push_back(move{&e, c, key});
+        }
+        for (entity* e : r.second->entities)
+        {
+            int64_t key = region_key(e->x, e->z);
+            if (!e->controlled && key != e->region)
+                moves.push_back(move{e, nullptr, key});
+        }
+    }
+
+    std::sort(moves.begin(), moves.end(), [](const move& a, const move& b) { return a.e->id < b.e->id; });
+
+    for (const move& m : moves)
+    {
+        region& to = regions_[m.to];
+        to.entities.push_back(m.e);
+        if (m.c)
+            to.clients.push_back(m.c);
+
+        region& from = regions_[m.e->region];
+        erase_value(from.entities, m.e);
+        if (m.c)
+            erase_value(from.clients, m.c);
+        if (from.entities.empty())
+            regions_.erase(m.e->region);
+
+        m.e->region = m.to;
+    }
+
+    if (moves.size())
+        sort_regions();
+    return moves.size();
+}
+
+void world::broadcast()
+{
+    std::vector<connection*> targets;
+    targets.reserve(clients_.size());
+    for (client* c : clients_)
+        targets.push_back(c->get_connection());
+
+    // Entity teleport for every player that moved, to everyone but the player
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+        entity& e = clients_[i]->player();
+        if (!e.moved)
+            continue;
+        e.moved = false;
+
+        packets::play::entity_teleport teleport;
+        teleport.entity_id = e.id;
+        teleport.x = static_cast<int32_t>(e.x * 32);
+        teleport.y = static_cast<int32_t>(e.y * 32);
+        teleport.z = static_cast<int32_t>(e.z * 32);
+        teleport.yaw = angle(e.yaw);
+        teleport.pitch = angle(e.pitch);
+        teleport.on_ground = e.on_ground;
+        packet_ptr p = make_packet(teleport);
+        ::broadcast(p, targets.begin(), targets.begin() + i);
+        ::broadcast(p, targets.begin() + i + 1, targets.end());
+    }
+
+    if (tick_ % keep_alive_interval == 0 && targets.size())
+    {
+        packet_ptr p = make_packet(packets::play::keep_alive{static_cast<int32_t>(tick_)});
+        ::broadcast(p, targets);
+    }
+
+    // The connections are corked, everything we sent this tick goes out now
+    for (connection* c : targets)
+        c->flush();
+
+    for (entity& e : entities_)
+        e.moved = false;
+}
+
+chunk& world::get_chunk(int32_t x, int32_t z)
+{
+    std::unique_ptr<chunk>& c = chunks_[pack_key(x, z)];
+    if (!c)
+    {
+        c.reset(new chunk{x, z});
+        generate_flat(*c);
+    }
+    return *c;
+}
+
+// Sends every player the next chunks of its chunk_stream, as many as its
+// connection can take, and sweeps the chunks nobody needs anymore now and then.
+void world::stream_chunks(tick_timings& t)
+{
+    // The chunks of all players are picked first, so the ones that have to be
+    // encoded (and compressed) are encoded together on the compression pool
+    std::vector<std::vector<const chunk*>> batches(clients_.size());
+    std::vector<const chunk*> chunks;
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+        pick_chunks(clients_[i], batches[i]);
+        chunks.insert(chunks.end(), batches[i].begin(), batches[i].end());
+    }
+    chunk_cache_.prepare(chunks, compression_pool_);
+
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+        client* c = clients_[i];
+        send_chunks(c, batches[i]);
+
+        chunk_stream_stats s = c->chunks().stats();
+        t.chunks_queued += s.queued;
+        t.max_chunk_queue = std::max<uint64_t>(t.max_chunk_queue, s.queued);
+    }
+
+    if (tick_ % chunk_unload_interval == 0)
+        unload_chunks();
+    t.loaded_chunks = chunks_.size();
+}
+
+// Tells the client to unload the chunks that went out of range and takes the
+// chunks it gets this tick off its queue
+void world::pick_chunks(client* c, std::vector<const chunk*>& batch)
+{
+    const entity& e = c->player();
+    chunk_stream& stream = c->chunks();
+    connection* con = c->get_connection();
+
+    std::vector<chunk_stream::position> unload;
+    stream.move_to(static_cast<int32_t>(std::floor(e.x)) >> 4, static_cast<int32_t>(std::floor(e.z)) >> 4, unload);
+    for (const chunk_stream::position& p : unload)
+    {
+        // A ground-up chunk without sections unloads the chunk on the client
+        con->send(make_packet(packets::play::chunk_data{p.first, p.second, true, 0, byte_array{}}));
+    }
+
+    // Chunks aren't split up, the last chunk of a tick may go over the limit
+    // Uncompressed sizes, with compression this leaves room to spare
+    size_t pending = con->pending_bytes();
+    chunk_stream::position p;
+    while (batch.size() < max_chunks_per_tick && pending < max_pending_chunk_bytes && stream.next(p))
+    {
+        batch.push_back(&get_chunk(p.first, p.second));
+        pending += batch.back()->data_size();
+    }
+}
+
+void world::send_chunks(client* c, const std::vector<const chunk*>& batch)
+{
+    connection* con = c->get_connection();
+    for (size_t i = 0; i < batch.size(); i += chunk_cache::max_bulk_chunks)
+    {
+        size_t end = std::min(batch.size(), i + chunk_cache::max_bulk_chunks);
+        if (end - i == 1)
+            con->send(chunk_cache_.chunk_data(*batch[i]));
+        else
+            con->send(chunk_cache_.map_chunk_bulk(&batch[i], &batch[0] + end));
+    }
+}
+
+// Drops the chunks that are out of range of every player, and their packets
+void world::unload_chunks()
+{
+    std::unordered_set<int64_t> needed;
+    for (client* c : clients_)
+        c->chunks().for_each_in_range([&needed](int32_t x, int32_t z) { needed.insert(pack_key(x, z)); });
+
+    for (auto it = chunks_.begin(); it != chunks_.end(); )
+    {
+        if (needed.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        chunk_cache_.erase(it->second->x(), it->second->z());
+        it = chunks_.erase(it);
+    }
+}
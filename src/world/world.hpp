@@ -0,0 +1,238 @@
+/* 
+ * Bariumsulfate, a clean room minecraft server implementatien
+ * Copyright (C) 2014 Bert <bariumsulfate@openmailbox.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BARIUMSULFATE__WORLD__WORLD_HPP
+#define BARIUMSULFATE__WORLD__WORLD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <misc/task_pool.hpp>
+#include <protocol/compression.hpp>
+#include <server/status_cache.hpp>
+#include <world/chunk.hpp>
+#include <world/chunk_cache.hpp>
+#include <world/entity.hpp>
+
+class authenticator;
+class client;
+
+// Where the time of a tick went, all durations in microseconds
+struct tick_timings
+{
+    uint64_t tick;       // number of the tick these timings belong to
+    uint64_t drain;      // handling the delayed packets of all clients
+    uint64_t simulate;   // updating the world, including region hand-offs
+    uint64_t broadcast;  // telling the clients what changed and flushing them
+    uint64_t total;
+    uint64_t overruns;   // ticks so far that took longer than tick_length
+    uint64_t skipped;    // ticks so far that were dropped to catch up
+    uint64_t regions;          // regions with entities in them
+    uint64_t border_entities;  // entities close enough to another region to interact with it
+    uint64_t handoffs;         // entities that moved to another region this tick
+    uint64_t stream;           // sending chunks to the players
+    chunk_cache_stats chunks;  // chunk packets sent so far
+    uint64_t chunks_queued;    // chunks waiting to be sent, all players together
+    uint64_t max_chunk_queue;  // most chunks a single player is waiting for
+    uint64_t loaded_chunks;    // chunks the world keeps in memory
+};
+
+// A square of region_size x region_size blocks (a group of chunk columns) and
+// everything in it. The tick handles every region on its own, so regions can be
+// worked on in parallel.
+struct region
+{
+    std::vector<client*> clients;
+    std::vector<entity*> entities;  // including the entities of the clients
+};
+
+/**
+ * The world runs in its own thread and ticks at a fixed rate of 20 ticks per
+ * second. Clients are added once they log in, from then on their delayed packets
+ * are handled in the ticks (see connection.hpp for what that means for the
+ * lifetime of the connection).
+ *
+ * A tick that takes longer than tick_length is an overrun. The ticks that should
+ * have happened in the meantime are caught up back to back, up to
+ * max_catchup_ticks, beyond that they are skipped.
+ *
+ * The world is split up in regions that are ticked in parallel on a task_pool:
+ *  - drain:     the packets of the clients in each region are handled in parallel
+ *  - simulate:  every region is simulated in parallel, entities only interact with
+ *               the entities in their own region
+ *  - borders:   entities within interaction_range of another region interact with
+ *               the entities over there, on the tick thread. Regions without such
+ *               entities don't take part.
+ *  - hand-off:  entities that ended up in another region are moved there, in order
+ *               of their id
+ *  - broadcast: on the tick thread
+ * Every step only depends on the positions and ids of the entities, so the result
+ * of a tick doesn't depend on the number of threads.
+ */
+class world : private boost::noncopyable
+{
+public:
+    static constexpr std::chrono::milliseconds tick_length{50};
+    static constexpr uint64_t max_catchup_ticks = 10;
+    // Most delayed packets handled for a single client in one tick
+    static constexpr size_t max_packets_per_tick = 64;
+    // Regions are 2^region_shift blocks (8 chunk columns) wide
+    static constexpr int region_shift = 7;
+    static constexpr int region_size = 1 << region_shift;
+    // Entities closer than this push each other apart
+    static constexpr double interaction_range = 0.6;
+    // Chunks around the player the player gets, in every direction
+    static constexpr int32_t view_distance = 4;
+    // Most chunks sent to a single player in one tick
+    static constexpr size_t max_chunks_per_tick = 16;
+    // No chunks are sent to a player while this many bytes are waiting for its
+    // socket, and a tick doesn't send more than what fits below it
+    static constexpr size_t max_pending_chunk_bytes = 256 * 1024;
+    // Ticks between sweeps for chunks that are out of range of every player
+    static constexpr uint64_t chunk_unload_interval = 100;
+    // What the server list shows
+    static constexpr size_t max_players = 20;
+
+    /**
+     * \param[in] threads     Threads used for ticking regions in parallel, including
+     *                        the tick thread itself.
+     * \param[in] compression Compression the clients are asked to use, its threads
+     *                        compress chunks.
+     * \param[in] auth        Authenticates players and sets up encryption (online
+     *                        mode), nullptr for offline mode. Must outlive the world.
+     */
+    explicit world(size_t threads = 1, const compression_config& compression = compression_config::disabled(),
+        authenticator* auth = nullptr);
+    ~world();
+
+    void start();
+    void stop();
+
+    /**
+     * Adds a client to the world, it takes part in the world starting next tick.
+     * Thread safe.
+     */
+    void add_client(client* c);
+
+    /**
+     * Adds an entity the world simulates on its own (not controlled by a client),
+     * it takes part in the world starting next tick. Thread safe.
+     */
+    void add_entity(const entity& e);
+
+    /**
+     * Runs a single tick on the calling thread. For benchmarks and tools that drive
+     * the world themselves, never call this while the world thread is running.
+     */
+    void tick();
+
+    // Thread safe, the configuration never changes
+    const compression_config& compression() const
+    {
+        return compression_;
+    }
+
+    // nullptr in offline mode. Thread safe, the authenticator is
+    authenticator* get_authenticator() const
+    {
+        return authenticator_;
+    }
+
+    // The server list ping response, thread safe
+    status_cache& status()
+    {
+        return status_;
+    }
+
+    int32_t next_entity_id()
+    {
+        return next_entity_id_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t player_count() const
+    {
+        return player_count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Timings of the last finished tick. Thread safe.
+     */
+    tick_timings timings();
+
+    static int64_t region_key(double x, double z);
+
+private:
+    void run();
+
+    void join();
+    void remove_closed_clients();
+    void drain_packets();
+    void simulate(tick_timings& t);
+    void simulate_region(region& r);
+    uint64_t resolve_borders();
+    static void collide(std::vector<entity*>& entities, bool cross_region_only);
+    uint64_t hand_off();
+    void stream_chunks(tick_timings& t);
+    void broadcast();
+
+    // The chunk at chunk coordinates x, z, generated if it isn't loaded yet
+    chunk& get_chunk(int32_t x, int32_t z);
+    void pick_chunks(client* c, std::vector<const chunk*>& batch);
+    void send_chunks(client* c, const std::vector<const chunk*>& batch);
+    void unload_chunks();
+
+    // Regions sorted by key, rebuilt by join()
+    void sort_regions();
+
+    boost::thread thread_;
+    std::atomic<bool> running_;
+
+    // mutex_ protects joining_, spawning_ and timings_
+    boost::mutex mutex_;
+    std::vector<client*> joining_;
+    std::vector<entity> spawning_;
+    tick_timings timings_;
+
+    // Only touched by the tick thread (and the pool during a phase)
+    task_pool pool_;
+    compression_config compression_;
+    task_pool compression_pool_;
+    authenticator* authenticator_;
+    status_cache status_;
+    std::vector<client*> clients_;
+    std::deque<entity> entities_;   // entities the world owns
+    std::unordered_map<int64_t, region> regions_;
+    std::vector<std::pair<int64_t, region*>> sorted_regions_;
+    std::unordered_map<int64_t, std::unique_ptr<chunk>> chunks_;
+    chunk_cache chunk_cache_;
+    uint64_t tick_;
+    uint64_t overruns_;
+    uint64_t skipped_;
+
+    std::atomic<int32_t> next_entity_id_;
+    std::atomic<size_t> player_count_;
+};
+
+#endif